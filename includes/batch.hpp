@@ -0,0 +1,38 @@
+#ifndef BATCH_HPP
+# define BATCH_HPP
+
+# include <iostream>
+# include <string>
+# include <vector>
+
+# include "expert-system.hpp"
+
+
+/*
+ * Batch
+ *
+ * Solves many input files in one process, on opts.jobs threads. The files
+ * are the regular files of a directory, sorted by name, or the lines of a
+ * list file ("-" reads the list from stdin, blank and '#' lines are skipped).
+ *
+ * Results come out in file order, each one a header with the exit status
+ * ./expert-system would have returned for that file, then what it would have
+ * printed, errors included:
+ *   ==> tests/shouldWork/00_socrates.txt <== 0
+ *   C is True
+ * */
+struct BatchResult {
+    std::string output;
+    int status;
+};
+
+std::vector<std::string> listBatchFiles(const std::string &path);
+
+// One file as the CLI solves it, honours the explain, dot and lazy options
+BatchResult solveBatchFile(const InputOptions &opts, const std::string &path);
+
+// Returns 0 when every file did
+int runBatch(const InputOptions &opts, std::ostream &out);
+
+
+#endif /* BATCH_HPP */
@@ -0,0 +1,56 @@
+#ifndef DAEMON_HPP
+# define DAEMON_HPP
+
+# include <string>
+# include <vector>
+
+# include "expert-system.hpp"
+# include "knowledge_base.hpp"
+
+
+/*
+ * Daemon
+ *
+ * Serves the rule files given on the command line over a local Unix socket.
+ * Every message, both ways, is a little endian uint32 length followed by that
+ * many bytes. Integers below are little endian too.
+ *
+ * Requests start with an opcode byte:
+ *   EVALUATE  u16 kb, u32 set, u32 clear, u8 n, n query letters
+ *             Solves the file number kb (in command line order) starting
+ *             from its `=` facts, plus the facts of the set mask, minus the
+ *             ones of the clear mask (bit 0 is A). n == 0 asks the file's
+ *             own `?` queries.
+ *   LIST      Names of the loaded files.
+ *
+ * Responses start with a status byte, OK or ERROR. An error is followed by
+ * its message. EVALUATE answers u8 n then one state byte per query,
+ * False 0, True 1, Undetermined 2, or 3 when the query ended in an error.
+ * LIST answers u16 count then, per file, u8 length and the name.
+ *
+ * A connection silent for --keep-alive seconds is closed, clients keeping
+ * one open between requests reconnect when it was.
+ * */
+namespace daemon_protocol {
+    enum Op : uint8_t { EVALUATE = 1, LIST = 2 };
+    enum Status : uint8_t { OK = 0, ERROR = 1 };
+    const size_t MAX_MESSAGE = 1 << 16;
+    const size_t MAX_CONNECTIONS = 64;  // served at once, the others wait
+}
+
+// Answers one request payload, without the length prefix
+std::string handleDaemonRequest(const std::vector<RuleFile> &kbs, const std::string &request);
+
+// Listening socket at path. A socket file nobody answers on is replaced,
+// anything else already there is an error.
+int bindDaemonSocket(const std::string &path);
+
+// Accepts on server_fd and serves kbs, closing connections idle for
+// idleSeconds, blocks
+void serveDaemon(int server_fd, const std::vector<RuleFile> &kbs, int idleSeconds);
+
+// Loads every file of opts and serves them on opts.daemonSocket, blocks
+void runDaemon(const InputOptions &opts);
+
+
+#endif /* DAEMON_HPP */
@@ -0,0 +1,61 @@
+#ifndef EXPERT_SYSTEM_H
+# define EXPERT_SYSTEM_H
+
+/*
+ * C interface of libES.so
+ *
+ * A knowledge base is loaded once, from rule text or from the bytes
+ * es_kb_compile produced, and can then be evaluated from any thread.
+ * Facts are passed as a mask, bit 0 is A. Queries are a NUL terminated
+ * string of letters, "CE" asks for C then E. Functions never throw, they
+ * report errors through their return value and, when given, an error buffer
+ * that is always NUL terminated.
+ */
+
+# include <stddef.h>
+# include <stdint.h>
+
+/* the library is built with hidden visibility, these are its only symbols */
+# if defined(__GNUC__)
+#  define ES_API __attribute__((visibility("default")))
+# else
+#  define ES_API
+# endif
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+typedef struct es_kb es_kb;
+
+typedef enum {
+    ES_FALSE = 0,
+    ES_TRUE = 1,
+    ES_UNDETERMINED = 2,
+    ES_ERROR = 3  /* the query ended in a contradiction */
+} es_state;
+
+/* NULL on error */
+ES_API es_kb *es_kb_load_text(const char *rules, char *err, size_t err_size);
+ES_API es_kb *es_kb_load_compiled(const uint8_t *bytes, size_t size, char *err, size_t err_size);
+
+/* Writes the compiled rules if they fit in buf and returns their size, call
+ * with a NULL buf to get the size */
+ES_API size_t es_kb_compile(const es_kb *kb, uint8_t *buf, size_t buf_size);
+
+/* Writes one state per query in out, returns the number of queries or -1 if
+ * the queries are invalid or don't fit in out_size */
+ES_API int es_kb_evaluate(const es_kb *kb, uint32_t facts, const char *queries,
+        es_state *out, size_t out_size, char *err, size_t err_size);
+
+/* count fact sets at once, out is count rows of one state per query */
+ES_API int es_kb_evaluate_batch(const es_kb *kb, const uint32_t *facts, size_t count,
+        const char *queries, es_state *out, size_t out_size, char *err, size_t err_size);
+
+ES_API void es_kb_free(es_kb *kb);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* EXPERT_SYSTEM_H */
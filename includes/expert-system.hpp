@@ -10,11 +10,33 @@
 # include <stdexcept>
 # include <unordered_map>
 # include <set>
+# include <vector>
+# include <memory>
+# include <cstdint>
+# include <optional>
+# include <functional>
+# include <exception>
 # include "expression.hpp"
 
+class ThreadPool;
+
 struct InputOptions {
     char *file = nullptr;
+    std::vector<char *> files; // every file given, file is the last one
+    std::string daemonSocket;
+    std::string batch;         // directory or list of files for --batch
     int port = 7711;
+    int backlog = 128;          // listen queue of the server
+    size_t threads = 0;         // server workers, 0: one per core
+    size_t workers = 0;         // server processes, 0: no supervisor
+    int requestTimeout = 30;    // seconds before a stuck worker process restarts
+    int keepAlive = 5;          // seconds an idle connection stays open
+    size_t maxBody = 256;       // MB of a request body
+    size_t sessionMemory = 64;  // MB of compiled rules kept by the server
+    size_t cacheMemory = 64;    // MB of evaluation results kept by the server
+    std::string graphFormat = "svg"; // of the server graphs, svg or png
+    size_t dotDepth = 0;        // of the exported query cone, 0: no limit
+    size_t dotFanIn = 0;        // rules concluding a fact before they are collapsed
     bool isHelp = false;
     bool isServer = false;
     bool isExplain = false;
@@ -22,10 +44,14 @@ struct InputOptions {
     bool isInteractive = false;
     bool isCustom = false;
     bool isOpenWorldAssumption = false;
+    bool isLazy = false;
+    bool isScenarios = false;
+    bool isStream = false;
+    size_t jobs = 1;
 
 };
 
-std::string getFileInput(char *fileName);
+std::string getFileInput(const char *fileName);
 
 using std::string;
 using std::vector;
@@ -152,6 +178,13 @@ struct Query {
     }
 };
 
+// One "=" line and the "?" line following it, in a multi-scenario input
+struct Scenario {
+    std::vector<Fact> facts;
+    std::vector<Query> queries;
+    size_t line_number;
+};
+
 inline std::ostream& operator<<(std::ostream& os, const Query& q) {
     return os << q.toString();
 }
@@ -164,6 +197,137 @@ inline std::ostream& operator<<(std::ostream& os, const Query& q) {
 // of both structs, it's a hashMap so elements are unique
 
 
+// Three-valued state of every fact A-Z, packed in two bitmasks
+struct FactStates {
+    uint32_t known = 0; // bit set when the fact is True or False
+    uint32_t truth = 0; // bit set when the fact is True
+
+    Fact::State get(char label) const {
+        const uint32_t bit = 1u << (label - 'A');
+        if (!(known & bit))
+            return Fact::State::Undetermined;
+        return (truth & bit) ? Fact::State::True : Fact::State::False;
+    }
+
+    void set(char label, Fact::State state) {
+        const uint32_t bit = 1u << (label - 'A');
+        known = state == Fact::State::Undetermined ? known & ~bit : known | bit;
+        truth = state == Fact::State::True ? truth | bit : truth & ~bit;
+    }
+
+    // Both masks in one word, so a state can be published atomically
+    uint64_t pack() const { return (uint64_t(known) << 32) | truth; }
+    static FactStates unpack(uint64_t word) {
+        return {uint32_t(word >> 32), uint32_t(word)};
+    }
+
+    bool operator==(const FactStates &) const = default;
+};
+
+
+// Names of the rules the solver found useless. A set layered over another
+// reads that one through base and keeps only its own insertions and
+// erasures, so layering costs nothing and dropping the layer undoes them.
+struct RuleSet {
+    std::shared_ptr<const RuleSet> base;
+    std::set<std::string> added;
+    std::set<std::string> erased; // names of base hidden by this layer
+
+    bool contains(const std::string &rule) const {
+        if (added.contains(rule))
+            return true;
+        return base && !erased.contains(rule) && base->contains(rule);
+    }
+
+    // true when it was not in
+    bool insert(const std::string &rule) {
+        if (contains(rule))
+            return false;
+        erased.erase(rule);
+        added.insert(rule);
+        return true;
+    }
+
+    void insert(const RuleSet &other) {
+        for (const auto &rule : other.all())
+            insert(rule);
+    }
+
+    void erase(const std::string &rule) {
+        added.erase(rule);
+        if (base && base->contains(rule))
+            erased.insert(rule);
+    }
+
+    // Every name, the layers below included
+    std::set<std::string> all() const {
+        std::set<std::string> res = base ? base->all() : std::set<std::string>{};
+        for (const auto &rule : erased)
+            res.erase(rule);
+        res.insert(added.begin(), added.end());
+        return res;
+    }
+};
+
+
+// Everything the solver writes while answering queries. The Digraph is only
+// read while solving, so each context can be solved on its own thread.
+struct SolveContext {
+    FactStates states;
+    std::vector<char> solving_stack; // Add this for cycle detection
+    std::ostringstream explanation;
+    // shared, never changed once compiled
+    std::map<char, std::shared_ptr<const Expr>> compiled_expressions;
+    RuleSet useless_rules;
+    std::set<char> defered_set_false; // defer set as false 
+    std::set<char> settled; // facts whose component is fully solved
+
+    // Memo of solveExpr results, keyed on the address of the node in the
+    // rule's expression tree. An entry is only valid for the epoch it was
+    // computed in, the epoch advances whenever the solver changes a fact state
+    // or one of the sets above. A result that was cut short by a cycle on a
+    // fact already on the solving_stack when the node was entered depends on
+    // that stack, it is not stored. cycle_low is the lowest solving_stack
+    // index hit by a cycle cut. Cleared at each top-level solve.
+    struct Memo {
+        uint64_t epoch;
+        Fact::State state;
+    };
+    std::unordered_map<const Expr *, Memo> memo;
+    uint64_t epoch = 0;
+    size_t cycle_low = SIZE_MAX;
+    size_t solve_depth = 0;
+
+    // Threads solveInDependencyOrder may use for independent components,
+    // the calling one plus idle workers of pool
+    size_t jobs = 1;
+    ThreadPool *pool = nullptr;
+
+    // Copy of everything but the explanation and the memo
+    SolveContext fork() const;
+    // Same, but reading base's useless rules through a layer instead of
+    // copying them. Costs the fact sets and the compiled expression pointers,
+    // at most one per fact, whatever the number of rules.
+    static SolveContext overlay(const std::shared_ptr<const SolveContext> &base);
+};
+
+
+// What Digraph::writeDot exports. With queries, only their backward cone:
+// the rules concluding them, the facts those rules read, their rules, ...
+struct DotOptions {
+    std::vector<char> queries;  // empty: the whole graph
+    size_t depth = 0;           // levels of rules below the queries, 0: no limit
+    size_t maxFanIn = 0;        // more rules concluding a fact are one node, 0: never
+};
+
+inline DotOptions queryCone(const std::vector<Query> &queries, size_t depth, size_t maxFanIn) {
+    DotOptions res{{}, depth, maxFanIn};
+    for (const auto &q : queries)
+        res.queries.push_back(q.label);
+    return res;
+}
+
+
 struct Digraph {
     using FactsMap = std::unordered_map<char, Fact>;
     using RulesMap = std::unordered_map<std::string, Rule>;
@@ -174,18 +338,17 @@ struct Digraph {
         bool isError;
     };
 
+    // The graph, Fact::state is the state a fact starts a solve with
     FactsMap facts;
     RulesMap rules;
-    std::set<char> solving_stack; // Add this for cycle detection
     bool isExplain = false;
     bool isClosedWorldAssumption = true;
-    std::ostringstream explanation;
-    std::map<char, Expr> compiled_expressions;
-    std::set<std::string> useless_rules;
-    std::set<char> defered_set_false; // defer set as false 
+
+    // Context used by the single threaded API below
+    SolveContext context;
 
 //    FactMap  questFacts; // facts for which a search is already launched
-    int countDeterminedAntecedents(const std::string& rule_id);
+    int countDeterminedAntecedents(const SolveContext &ctx, const std::string& rule_id) const;
     void addFact(const Fact &fact);
 
     // add rule implicitly will also add relevant facts
@@ -193,24 +356,131 @@ struct Digraph {
 
     std::string toString() const;
     std::string toDot() const;
+    void writeDot(std::ostream &out, const DotOptions &options = {}) const;
+
+    // Fresh context, every fact in its starting state
+    SolveContext newContext() const;
 
     // These two functions are mutually recursive
     Fact::State solveForFact(const char fact_id);
     Fact::State solveRule(const std::string &rule_id);
+    Fact::State solveForFact(SolveContext &ctx, const char fact_id) const;
+    Fact::State solveRule(SolveContext &ctx, const std::string &rule_id) const;
 
-    bool isLeafRule(const std::string &rule_id) const;
+    bool isLeafRule(const SolveContext &ctx, const std::string &rule_id) const;
     bool isFactInAmbiguousConclusion(char fact_id) const;
-    void setExprVarsToState(const Expr &expr, const Fact::State state);
+    void setExprVarsToState(SolveContext &ctx, const Expr &expr, const Fact::State state) const;
+    void setFactState(SolveContext &ctx, char fact_id, Fact::State state) const;
 
     Fact::State solveExpr(const Expr &expr);
+    Fact::State solveExpr(SolveContext &ctx, const Expr &expr) const;
 
     SolveRes solveEverythingNoThrow(const std::vector<Query> &queries);
+    // Queries with disjoint dependency cones are answered in their own
+    // context, jobs of them at a time. Results are merged back in query order.
+    SolveRes solveQueriesParallel(const std::vector<Query> &queries, size_t jobs) const;
+    // Queries whose dependency cones overlap, directly or through other
+    // queries, each group in query order
+    struct QueryGroup {
+        uint32_t cone;
+        std::vector<size_t> queries;
+    };
+    std::vector<QueryGroup> groupQueries(const std::vector<Query> &queries) const;
+    std::optional<Fact::State> answerQuery(SolveContext &ctx, const Query &query, const Expr &expr,
+            std::ostream &conclusion, std::ostream &explanation) const;
     void applyWorldAssumption(bool open);
+    void applyWorldAssumption(SolveContext &ctx, bool open) const;
+    // Moves the starting facts to given after a solve of queries that ended
+    // without an error. Only the queries whose cone group (see groupQueries)
+    // holds a changed fact have their facts go back to their starting state,
+    // the rest of what context found is kept. Returns the mask of the facts
+    // reset.
+    uint32_t updateFacts(const std::vector<Fact> &given,
+            const std::vector<Query> &queries, bool open);
+    FactStates startingStates() const;
+    // ctx was solved for queries from the starting states from, resets what
+    // a solve from to must redo, every query group if all
+    uint32_t resetToStart(SolveContext &ctx, const FactStates &from, const FactStates &to,
+            const std::vector<Query> &queries, bool all) const;
+
+    // What solveEverythingNoThrow answered, per query. After updateFacts the
+    // next solve only answers the queries it reset, the others are unchanged.
+    struct Answer {
+        std::string conclusion;
+        std::string explanation;
+        bool isError;
+    };
+    std::vector<Answer> answers;
+
+    // A solved state to ask "what if" against. Copying a Snapshot shares the
+    // solved context and answers, take one per solve and ask it every what-if.
+    // Taking one copies the context once. A whatIf whose facts reach a query
+    // layers a context over snap's (SolveContext::overlay) and only resets
+    // and solves again the facts of the groups the change reaches. A whatIf
+    // no query can see shares snap's. The snapshot a fork came from is never
+    // written to, so rolling back is dropping the fork.
+    struct Snapshot {
+        FactStates start; // starting states it was solved from
+        std::shared_ptr<const SolveContext> solved;
+        std::shared_ptr<const std::vector<Answer>> answers; // null if none
+        SolveRes result() const;
+    };
+    // The state the last solveEverythingNoThrow left
+    Snapshot snapshot() const;
+    // snap solved again with the facts of the masks starting True or False,
+    // queries are the ones snap was solved for
+    Snapshot whatIf(const Snapshot &snap, uint32_t set_true, uint32_t set_false,
+            const std::vector<Query> &queries) const;
+    std::optional<uint32_t> updated; // facts reset by updateFacts
+
+    // Many sets of starting facts solved against the same rules, see
+    // scenarios.cpp. The graph is expected to be built without facts and
+    // without a world assumption applied, each scenario gets the closed one.
+    struct ScenarioRes {
+        std::vector<Fact::State> states; // per query, Undetermined on error
+        std::vector<bool> errors;        // per query, true if it ended in an error
+        std::string conclusion;          // as solveEverythingNoThrow has it
+        bool isError;
+    };
+    std::vector<ScenarioRes> solveScenarios(const std::vector<std::vector<Fact>> &scenarios,
+            const std::vector<Query> &queries) const;
+    // The expression of a query as compileExprForFact makes it for ctx
+    using QueryCompiler = std::function<std::shared_ptr<const Expr>(SolveContext &ctx, char fact_id)>;
+    ScenarioRes solveScenario(uint32_t initial, const std::vector<Query> &queries,
+            const QueryCompiler &compile = nullptr) const;
+    bool isBitSliceable() const;
 
     using VarBoolMap = std::map<char, std::vector<bool>>;
     VarBoolMap boolMapEvaluate(const Expr &expr) const;
+    VarBoolMap boolMapEvaluate(const SolveContext &ctx, const Expr &expr) const;
     Expr compileExprForFact(const char fact_id);
-    Fact::State determinFinalState(Fact::State solverRes, const VarBoolMap &boolMap, char fact_id);
+    Expr compileExprForFact(SolveContext &ctx, const char fact_id) const;
+    Fact::State determinFinalState(SolveContext &ctx, Fact::State solverRes, const VarBoolMap &boolMap, char fact_id) const;
+
+    // Strongly connected components of the fact dependency graph, built by
+    // freeze(). A fact depends on the premis facts of the rules concluding it
+    // and on the other facts those rules conclude. Components are stored in
+    // topological order, each one after the components it depends on.
+    struct Scc {
+        std::vector<char> facts;
+        bool isCyclic;
+    };
+    bool frozen = false;
+    std::vector<Scc> sccs;
+    std::unordered_map<char, size_t> scc_of;
+    std::unordered_map<char, std::vector<char>> dependencies;
+    void freeze();
+    void solveInDependencyOrder(SolveContext &ctx, char fact_id) const;
+
+    // A component solved off the main context by presolveParallel, with the
+    // exception it ended on if any
+    struct Presolved {
+        SolveContext ctx;
+        std::exception_ptr error;
+    };
+    std::vector<std::optional<Presolved>> presolveParallel(
+            const SolveContext &ctx, const std::vector<char> &tasks) const;
+    uint32_t dependencyCone(char fact_id) const;
 };
 
 inline std::ostream& operator<<(std::ostream& os, const Digraph& g) {
@@ -231,10 +501,27 @@ inline std::ostream& operator<<(std::ostream& os, const InputOptions& opt) {
        << "Explain Mode: " << (opt.isExplain ? "Yes" : "No") << '\n'
        << "DOT Output: " << (opt.isDot ? "Yes" : "No") << '\n'
        << "Interactive Mode: " << (opt.isInteractive ? "Yes" : "No") << '\n'
-       << "Open World Assumption: " << (opt.isOpenWorldAssumption ? "Yes" : "No") << '\n';
-
+       << "Open World Assumption: " << (opt.isOpenWorldAssumption ? "Yes" : "No") << '\n'
+       << "Lazy Loading: " << (opt.isLazy ? "Yes" : "No") << '\n'
+       << "Scenarios: " << (opt.isScenarios ? "Yes" : "No") << '\n'
+       << "Stream: " << (opt.isStream ? "Yes" : "No") << '\n'
+       << "Jobs: " << opt.jobs << '\n';
+
+    if (!opt.daemonSocket.empty())
+        os << "Daemon Socket: " << opt.daemonSocket << '\n';
+    if (!opt.batch.empty())
+        os << "Batch: " << opt.batch << '\n';
     if (opt.port != 0)
         os << "Port: " << opt.port << '\n';
+    if (opt.isServer)
+        os << "Session Memory: " << opt.sessionMemory << " MB\n"
+           << "Cache Memory: " << opt.cacheMemory << " MB\n"
+           << "Graph Format: " << opt.graphFormat << '\n'
+           << "Backlog: " << opt.backlog << '\n'
+           << "Threads: " << opt.threads << '\n'
+           << "Workers: " << opt.workers << '\n'
+           << "Keep-Alive: " << opt.keepAlive << "s\n"
+           << "Max Body: " << opt.maxBody << " MB\n";
      if (opt.file && *opt.file)
         os << "File: " << opt.file << '\n';
 
@@ -38,7 +38,7 @@ private:
 struct Not {
     explicit Not(const Expr &c);
     Not() = delete;
-    Expr child() const;
+    const Expr &child() const;
 private:
     ExprBoxed _v;
 };
@@ -47,8 +47,8 @@ private:
 struct And {
     explicit And(const Expr &l, const Expr &r);
     And() = delete;
-    Expr lhs() const;
-    Expr rhs() const;
+    const Expr &lhs() const;
+    const Expr &rhs() const;
 private:
     ExprBoxed _v;
 };
@@ -57,8 +57,8 @@ private:
 struct Or {
     explicit Or(const Expr &l, const Expr &r);
     Or() = delete;
-    Expr lhs() const;
-    Expr rhs() const;
+    const Expr &lhs() const;
+    const Expr &rhs() const;
 private:
     ExprBoxed _v;
 };
@@ -67,8 +67,8 @@ private:
 struct Xor {
     explicit Xor(const Expr &l, const Expr &r);
     Xor() = delete;
-    Expr lhs() const;
-    Expr rhs() const;
+    const Expr &lhs() const;
+    const Expr &rhs() const;
 private:
     ExprBoxed _v;
 };
@@ -77,8 +77,8 @@ private:
 struct Imply {
     explicit Imply(const Expr &l, const Expr &r);
     Imply() = delete;
-    Expr lhs() const;
-    Expr rhs() const;
+    const Expr &lhs() const;
+    const Expr &rhs() const;
 private:
     ExprBoxed _v;
 };
@@ -87,8 +87,8 @@ private:
 struct Iff {
     explicit Iff(const Expr &l, const Expr &r);
     Iff() = delete;
-    Expr lhs() const;
-    Expr rhs() const;
+    const Expr &lhs() const;
+    const Expr &rhs() const;
 private:
     ExprBoxed _v;
 };
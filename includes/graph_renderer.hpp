@@ -0,0 +1,68 @@
+#ifndef GRAPH_RENDERER_HPP
+# define GRAPH_RENDERER_HPP
+
+# include <functional>
+# include <memory>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+
+# include "result_cache.hpp"
+# include "thread_pool.hpp"
+
+
+/*
+ * Graph renderer
+ *
+ * Renders the graphs of the results pages apart from the answers, one at a
+ * time on a thread of its own, so that a page does not wait for the layout.
+ * The page points to /graph/<key>, the key is the hex SHA-256 of the format
+ * and the DOT.
+ *
+ * Images are kept in an LRU of `capacity` bytes. A DOT queued stays pending
+ * until its image is in, an image asked for while pending is rendered at
+ * once. A key neither pending nor cached is unknown: the image was dropped,
+ * queueing its DOT again brings it back.
+ * */
+struct RenderedGraph {
+    std::string image;  // svg (without its xml prolog) or png
+
+    size_t size() const { return image.size(); }
+};
+
+class GraphRenderer {
+public:
+    using Render = std::function<std::string(const std::string &dot, const std::string &format)>;
+
+    // render defaults to graphviz, "" in a build without it
+    GraphRenderer(size_t capacity, const std::string &format, Render render = graphviz);
+
+    static std::string keyOf(const std::string &dot, const std::string &format);
+    std::string key(const std::string &dot) const { return keyOf(dot, _format); }
+    const std::string &format() const { return _format; }
+
+    // Renders on the thread unless cached or on its way, returns the key
+    std::string queue(const std::string &dot);
+    // nullptr for an unknown key
+    std::shared_ptr<const RenderedGraph> image(const std::string &key);
+    // Returns once what was queued before is rendered
+    void wait();
+
+    size_t size() const { return _images.size(); }
+
+    static std::string graphviz(const std::string &dot, const std::string &format);
+
+private:
+    const std::string _format;
+    const Render _render;
+    LruCache<RenderedGraph> _images;
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, std::string> _pending;  // key and DOT
+    ThreadPool _thread{1};  // last, so destroyed first: drained while the rest is there
+
+    std::shared_ptr<const RenderedGraph> render(const std::string &dot) const;
+};
+
+
+#endif /* GRAPH_RENDERER_HPP */
@@ -0,0 +1,147 @@
+#ifndef HTTP_HPP
+# define HTTP_HPP
+
+# include <list>
+# include <memory>
+# include <string>
+# include <string_view>
+# include <utility>
+# include <vector>
+# include <sys/uio.h>
+
+
+struct HttpRequest {
+    std::string method;
+    std::string target;   // path and query string, as sent
+    std::string version;  // "HTTP/1.1"
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;     // with any chunked encoding removed
+
+    // Value of the header name in any case, empty if absent
+    std::string header(const std::string &name) const;
+    std::string path() const;
+    std::string query() const;
+
+    // HTTP/1.1 keeps the connection unless told to close, HTTP/1.0 closes
+    // it unless asked not to
+    bool isKeepAlive() const;
+};
+
+
+/*
+ * HttpResponse
+ *
+ * A response kept as separate buffers and sent with one writev, the status
+ * line and headers, then each part of the body, none of them joined. Parts
+ * given to appendStatic (string literals, templates built once) are only
+ * pointed to, shared ones (cached results) are pointed to and kept alive,
+ * the others are moved in and kept by the response.
+ *
+ *   HttpResponse res;
+ *   res.head = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+ *   res.appendStatic("Hello ");
+ *   res.append(std::move(name));
+ *   res.finish(keepAlive); // adds Content-Length, Connection and the blank line
+ * */
+class HttpResponse {
+public:
+    std::string head;
+
+    HttpResponse() = default;
+    HttpResponse(HttpResponse &&) = default;
+    HttpResponse &operator=(HttpResponse &&) = default;
+    // the parts point into owned
+    HttpResponse(const HttpResponse &) = delete;
+    HttpResponse &operator=(const HttpResponse &) = delete;
+
+    void append(std::string part);
+    void appendStatic(std::string_view part);
+    void appendShared(std::shared_ptr<const std::string> part);
+    // The body parts of other, after these
+    void append(HttpResponse &&other);
+
+    size_t bodySize() const;
+    size_t size() const { return head.size() + bodySize(); }
+
+    // A HEAD response keeps the Content-Length of its body, but not the body
+    void finish(bool keepAlive, bool isHead = false);
+
+    // Fills at most max iovecs with what is left after sent bytes, returns
+    // how many were filled
+    int iovecs(size_t sent, iovec *iov, int max) const;
+
+    // The whole response in one string, for tests
+    std::string str() const;
+
+private:
+    std::vector<std::string_view> parts;
+    std::list<std::string> owned; // nodes never move, even when spliced
+    std::vector<std::shared_ptr<const std::string>> shared;
+};
+
+
+/*
+ * HttpParser
+ *
+ * Incremental request parser for one connection. Bytes are fed as they are
+ * read and each one is looked at once, whatever the size of the reads.
+ * Bodies come from Content-Length or chunked transfer encoding, anything
+ * after a complete request is kept for the next one (pipelining).
+ *
+ *   parser.feed(buffer, bytes);
+ *   while (parser.hasRequest())
+ *       answer(parser.take());
+ *   if (parser.hasError())
+ *       reply parser.errorStatus() and close
+ * */
+class HttpParser {
+public:
+    static const size_t MAX_HEADERS = 8 << 20; // a GET can carry rules in its URL
+
+    HttpParser() : HttpParser(256 << 20) {}
+    explicit HttpParser(size_t maxBody);
+
+    void feed(const char *data, size_t size);
+
+    bool hasRequest() const { return state == State::Done; }
+    // The complete request, parsing goes on with what is left
+    HttpRequest take();
+
+    bool hasError() const { return state == State::Error; }
+    int errorStatus() const { return _errorStatus; }
+    const std::string &errorMessage() const { return _errorMessage; }
+
+    // true once per request whose client waits for "100 Continue"
+    bool takeContinue();
+
+    // Bytes held, parsed or not, for the request in progress and after it
+    size_t buffered() const { return buffer.size() - pos + current.body.size(); }
+    // Some of a request was received
+    bool isStarted() const { return state != State::RequestLine || pos < buffer.size(); }
+
+private:
+    enum class State { RequestLine, Headers, Body, ChunkSize, ChunkData, ChunkEnd, Trailers, Done, Error };
+
+    State state = State::RequestLine;
+    std::string buffer;
+    size_t pos = 0;          // start of what is not parsed
+    size_t scanned = 0;      // where the search for the end of line resumes
+    size_t headerBytes = 0;
+    size_t remaining = 0;    // of the body or of the current chunk
+    size_t maxBody;
+    bool isContinue = false;
+    HttpRequest current;
+    int _errorStatus = 0;
+    std::string _errorMessage;
+
+    void parse();
+    bool nextLine(std::string &line);
+    void requestLine(const std::string &line);
+    void headerLine(const std::string &line);
+    void headersDone();
+    void chunkSize(const std::string &line);
+    void fail(int status, const std::string &message);
+};
+
+
+#endif /* HTTP_HPP */
@@ -0,0 +1,94 @@
+#ifndef KNOWLEDGE_BASE_HPP
+# define KNOWLEDGE_BASE_HPP
+
+# include <memory>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# include "expert-system.hpp"
+
+
+/*
+ * KnowledgeBase
+ *
+ * A rule set compiled once into a graph that is never written to again.
+ * Every evaluation solves on its own SolveContext, so a KnowledgeBase can be
+ * shared and evaluated from any number of threads, and copying it only
+ * copies a pointer to the graph.
+ *
+ * Evaluations follow the CLI: the given facts start True, the closed world
+ * assumption is applied, then the queries are answered in order.
+ *
+ * The expression a query is checked against stops at the facts already
+ * known when it is compiled, so it depends on the states of the facts in its
+ * cone. Each one is compiled once per such states and kept with the graph,
+ * an evaluation then only builds its context of fact states.
+ * */
+class KnowledgeBase {
+public:
+    using Result = Digraph::ScenarioRes;
+
+    explicit KnowledgeBase(const std::vector<Rule> &rules);
+    explicit KnowledgeBase(const std::vector<Expr> &rules);
+
+    // Rules in the input file syntax, `=` and `?` lines are not allowed
+    static KnowledgeBase fromText(const std::string &rules);
+
+    // Compiled form of the rules, see knowledge_base.cpp for the layout.
+    // fromBytes throws on anything serialize could not have produced.
+    std::vector<uint8_t> serialize() const;
+    static KnowledgeBase fromBytes(const uint8_t *bytes, size_t size);
+
+    // facts and queries are strings of fact letters, e.g. "AB" and "C"
+    Result evaluate(const std::string &facts, const std::string &queries) const;
+    Result evaluate(uint32_t facts, const std::vector<Query> &queries) const;
+
+    // Many fact sets against the same queries, see Digraph::solveScenarios
+    std::vector<Result> evaluateBatch(const std::vector<uint32_t> &facts,
+            const std::vector<Query> &queries) const;
+
+    const Digraph &graph() const { return *_graph; }
+    // Query expressions kept so far, see compiled()
+    size_t compiledCount() const;
+    // Bytes it may come to hold: the rule text, the graph and expression
+    // nodes, and the compiled expressions once MAX_EXPRS of them are kept
+    size_t memoryEstimate() const;
+
+    // Mask of the facts of "AB", bit 0 is A. Throws on anything but A-Z.
+    static uint32_t factMask(const std::string &facts);
+    static uint32_t factMask(const std::vector<Fact> &facts);
+    static std::vector<Query> queryList(const std::string &queries);
+
+private:
+    std::shared_ptr<const Digraph> _graph;
+    std::shared_ptr<const std::vector<Expr>> _rules; // in input order
+
+    struct Compiled {
+        static constexpr size_t MAX_EXPRS = 4096; // dropped all at once past it
+        std::mutex mutex;
+        // the query and the states of its cone, see compiled()
+        std::unordered_map<uint64_t, std::shared_ptr<const Expr>> exprs;
+    };
+    std::shared_ptr<Compiled> _compiled = std::make_shared<Compiled>();
+
+    std::shared_ptr<const Expr> compiled(SolveContext &ctx, char fact_id) const;
+
+};
+
+
+// An input file kept as a knowledge base plus its `=` and `?` lines, which
+// callers use as defaults. The `?` line is optional.
+struct RuleFile {
+    std::string name;
+    KnowledgeBase kb;
+    uint32_t facts;
+    std::vector<Query> queries;
+};
+
+RuleFile loadRuleFile(const std::string &path);
+RuleFile parseRuleFile(const std::string &name, const std::string &text);
+
+
+#endif /* KNOWLEDGE_BASE_HPP */
@@ -2,7 +2,21 @@
 
 
 std::tuple<vector<Rule>, vector<Fact>, vector<Query>>
-    parseTokens(const vector<Token> &input);
+    parseTokens(const vector<Token> &input, bool isQueryRequired = true);
+
+// Only parses the rules reachable backwards from the queries
+std::tuple<vector<Rule>, vector<Fact>, vector<Query>>
+    parseTokensQueryCone(const vector<Token> &input);
+
+// Facts of the "=" line of the tokens
+std::vector<Fact> parseFacts(const vector<Token> &input);
+
+// Facts to start True and False for a what-if, "A !C" is A True, C False
+std::pair<uint32_t, uint32_t> parseWhatIf(const std::string &line);
+
+// Rules once, then any number of "=" / "?" scenarios
+std::tuple<vector<Rule>, vector<Scenario>>
+    parseTokensScenarios(const vector<Token> &input);
 
 
 struct Parser {
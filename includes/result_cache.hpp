@@ -0,0 +1,204 @@
+#ifndef RESULT_CACHE_HPP
+# define RESULT_CACHE_HPP
+
+# include <functional>
+# include <future>
+# include <list>
+# include <memory>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# include "expert-system.hpp"
+
+
+/*
+ * LRU cache
+ *
+ * Values computed once and kept by key, at most `capacity` bytes of them
+ * (the key plus Value::size()), the least recently used are dropped first.
+ * A value handed out stays valid after it is evicted.
+ *
+ * getOrCompute also coalesces: while a key is being computed, the requests
+ * for it wait for that result instead of computing it again.
+ * */
+template <typename Value>
+class LruCache {
+public:
+    using Compute = std::function<std::shared_ptr<const Value>()>;
+
+    explicit LruCache(size_t capacity) : _capacity(capacity) {}
+
+    // nullptr on a miss, counted either way
+    std::shared_ptr<const Value> get(const std::string &key) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            _misses++;
+            return nullptr;
+        }
+        _hits++;
+        _lru.splice(_lru.begin(), _lru, it->second);
+        return it->second->value;
+    }
+
+    // Values larger than the whole cache are not kept
+    void put(const std::string &key, std::shared_ptr<const Value> value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        insert(key, std::move(value));
+    }
+
+    // The cached value, or the one being computed for the key, or compute's.
+    // What compute throws is thrown to every request waiting for it.
+    std::shared_ptr<const Value> getOrCompute(const std::string &key, const Compute &compute) {
+        std::promise<std::shared_ptr<const Value>> promise;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _index.find(key);
+            if (it != _index.end()) {
+                _hits++;
+                _lru.splice(_lru.begin(), _lru, it->second);
+                return it->second->value;
+            }
+            auto running = _inflight.find(key);
+            if (running != _inflight.end()) {
+                _coalesced++;
+                auto future = running->second;
+                lock.unlock();
+                return future.get();
+            }
+            _misses++;
+            _inflight.emplace(key, promise.get_future().share());
+        }
+
+        std::shared_ptr<const Value> value;
+        try {
+            value = compute();
+        } catch (...) {
+            // not cached, the next request for the key tries again
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _inflight.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        {
+            // cached and no longer running at once, a request comes in after both
+            std::lock_guard<std::mutex> lock(_mutex);
+            insert(key, value);
+            _inflight.erase(key);
+        }
+        promise.set_value(value);
+        return value;
+    }
+
+    // Without touching the counters or the order
+    bool contains(const std::string &key) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _index.count(key);
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _lru.size();
+    }
+
+    size_t memory() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _memory;
+    }
+
+    size_t hits() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hits;
+    }
+
+    size_t misses() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _misses;
+    }
+
+    // requests that waited for another's value
+    size_t coalesced() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _coalesced;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const Value> value;
+        size_t cost;
+    };
+
+    mutable std::mutex _mutex;
+    size_t _capacity;
+    size_t _memory = 0;
+    size_t _hits = 0;
+    size_t _misses = 0;
+    size_t _coalesced = 0;
+    std::list<Entry> _lru; // most recently used first
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> _index;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const Value>>> _inflight;
+
+    // called with the lock held
+    void insert(const std::string &key, std::shared_ptr<const Value> value) {
+        const size_t cost = key.size() + value->size();
+        if (cost > _capacity)
+            return;
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            // computed twice at once, the first one in is kept
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return;
+        }
+        _lru.push_front({key, std::move(value), cost});
+        _index[key] = _lru.begin();
+        _memory += cost;
+        while (_memory > _capacity && !_lru.empty()) {
+            _memory -= _lru.back().cost;
+            _index.erase(_lru.back().key);
+            _lru.pop_back();
+        }
+    }
+};
+
+
+/*
+ * Result cache
+ *
+ * What the server computed for a rule set, kept so that the same rules
+ * submitted again are answered without parsing or solving them again. The
+ * key is the SHA-256 of the token stream and of whatever else changes the
+ * answer (options, what-ifs): spacing differs, the key does not, while
+ * comments and line breaks, which show up in the explanation and in errors,
+ * are part of it.
+ * */
+struct Evaluation {
+    std::string conclusion;
+    std::string explanation;
+    std::string report;     // what-if branches, or the error
+    std::string img;        // graph as HTML
+    std::string dot;        // the graph, rendered apart
+    bool isSolved = false;  // otherwise the report holds the error
+
+    size_t size() const {
+        return conclusion.size() + explanation.size() + report.size() + img.size() + dot.size();
+    }
+};
+
+class ResultCache : public LruCache<Evaluation> {
+public:
+    using LruCache::LruCache;
+
+    // 32 raw bytes
+    static std::string keyOf(const std::vector<Token> &tokens, const std::string &options);
+    static std::string sha256(const std::string &data);
+    // two lowercase digits a byte
+    static std::string hex(const std::string &bytes);
+};
+
+
+#endif /* RESULT_CACHE_HPP */
@@ -1,38 +1,108 @@
 #pragma once
+#include <atomic>
 #include <string>
 #include <functional>
 #include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+#include "graph_renderer.hpp"
+#include "http.hpp"
+#include "result_cache.hpp"
+#include "session.hpp"
+#include "thread_pool.hpp"
+
+// Pre-forks opts.workers processes, each running its own WebServer on the
+// port (SO_REUSEPORT, the kernel spreads the connections). A worker that
+// dies is started again. Returns once stopped by SIGINT or SIGTERM. The
+// workers share nothing: sessions are refused and the graph links of the
+// pages carry their DOT, the worker getting one renders it.
+int runServerWorkers(const InputOptions &opts);
 
 class WebServer {
 public:
-    using Handler = std::function<std::string(const std::string& queryString)>;
+    using Handler = std::function<HttpResponse(const std::string& queryString)>;
+    using PostHandler = std::function<HttpResponse(const std::string& queryString, const std::string& body)>;
 
     WebServer(const InputOptions &opts);
     ~WebServer();
 
     // Register routes
     void registerGetRoutes();
+    void registerPostRoutes();
 
-    // Start the server (blocking)
+    // Start the server (blocking). One thread runs the epoll loop doing all
+    // socket I/O, complete requests are answered on the worker pool and the
+    // responses handed back to the loop for writing.
     void start();
+    // Safe from any thread, start returns at its next wake up
     void stop();
 
+    // The port bound, a free one when opts.port is 0
+    int port() const { return listenPort; }
+    // Times the loop came back from epoll_wait, a spinning loop shows in it
+    size_t wakeups() const { return wakeupCount; }
+
 private:
     int server_fd;
+    int listenPort;
+    std::atomic<bool> running{true};
+    std::atomic<size_t> wakeupCount{0};
+    int epoll_fd;
+    int wake_fd;  // eventfd, a worker finished a response
     const InputOptions opts;
     std::string prefillRuleset;
+    SessionStore sessions;
+    ResultCache cache;
+    GraphRenderer graphs;  // the pages point to its images
+    std::string cacheOptions;
 
-    enum class Status { OK=200, NOT_FOUND=404, SERVER_ERROR=500 };
+    enum class Status { OK=200, BAD_REQUEST=400, NOT_FOUND=404, PAYLOAD_TOO_LARGE=413,
+        HEADERS_TOO_LARGE=431, SERVER_ERROR=500, NOT_IMPLEMENTED=501, VERSION_NOT_SUPPORTED=505 };
     
-    // Route maps for GET
+    // Route maps for GET and POST
     std::unordered_map<std::string, Handler> get_routes;
+    std::unordered_map<std::string, PostHandler> post_routes;
 
-    std::string parsePath(const std::string& request) const;
-    std::string parseQueryString(const std::string& request) const;
-    std::string parseMethod(const std::string& request) const;
-    std::string readFullFequest(int client);
-    std::string constructHTMLResponse(Status status, const std::string& body) const;
+    HttpResponse respond(const HttpRequest& request, bool keepAlive);
+    HttpResponse evaluatePage(const std::string& params);
+    std::shared_ptr<const Evaluation> evaluate(const std::vector<Token>& tokens, const std::string& whatIfs);
+    HttpResponse graphImage(const std::string& key, const std::string& queryString);
+    HttpResponse constructHTMLResponse(Status status, const std::string& body = "") const;
+    HttpResponse constructHTMLResponse(Status status, HttpResponse &&content) const;
+    HttpResponse constructResponse(Status status, const std::string& contentType, std::string body) const;
  
+    static const size_t MAX_PIPELINED = 1 << 20;
+    static const int IOV_PER_WRITE = 64;
+
+    struct Connection {
+        HttpParser parser;      // requests not answered yet
+        HttpResponse response;
+        size_t sent = 0;        // of the response head and body
+        uint32_t events = 0;    // epoll interest
+        bool isBusy = false;    // on the worker pool, the fd stays open meanwhile
+        bool isClosed = false;  // the client went away while busy, out of epoll
+        bool isEof = false;     // the client sends nothing more
+        bool isKeepAlive = false;
+        std::chrono::steady_clock::time_point since;       // busy since
+        std::chrono::steady_clock::time_point lastActive;  // last read or write
+    };
+    std::unordered_map<int, Connection> connections;
+
+    std::mutex doneMutex;
+    std::vector<std::pair<int, HttpResponse>> done;  // fd and its response
+    std::optional<ThreadPool> workers;
+
+    void acceptClients();
+    void watch(int client);
+    void readClient(int client);
+    void nextRequest(int client);
+    void writeClient(int client);
+    void closeClient(int client);
+    void collectResponses();
+    void checkTimeouts();
+
     class Route {
         std::string path;
         Handler handler;
@@ -0,0 +1,57 @@
+#ifndef SESSION_HPP
+# define SESSION_HPP
+
+# include <list>
+# include <memory>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+
+# include "knowledge_base.hpp"
+
+
+/*
+ * Sessions
+ *
+ * Rule sets uploaded once and kept compiled, so that later requests only
+ * carry facts and queries. A handle is the SHA-256 of the rule text in hex,
+ * uploading the same rules twice gives back the same session.
+ *
+ * The store holds at most `capacity` bytes of compiled rules, each session
+ * charged KnowledgeBase::memoryEstimate, its compiled expressions included,
+ * and the least recently used sessions are dropped first. A RuleFile handed out by get
+ * stays valid after its session is evicted.
+ * */
+class SessionStore {
+public:
+    explicit SessionStore(size_t capacity);
+
+    // Compiles the rules unless already there, throws on parse errors
+    std::string add(const std::string &rules);
+
+    // nullptr when the handle is unknown or was evicted
+    std::shared_ptr<const RuleFile> get(const std::string &handle);
+
+    size_t size() const;
+    size_t memory() const;
+
+    static std::string handleOf(const std::string &rules);
+
+private:
+    struct Session {
+        std::string handle;
+        std::shared_ptr<const RuleFile> file;
+        size_t cost;
+    };
+
+    mutable std::mutex _mutex;
+    size_t _capacity;
+    size_t _memory = 0;
+    std::list<Session> _lru; // most recently used first
+    std::unordered_map<std::string, std::list<Session>::iterator> _index;
+
+    void evict();
+};
+
+
+#endif /* SESSION_HPP */
@@ -0,0 +1,44 @@
+#ifndef STREAM_HPP
+# define STREAM_HPP
+
+# include <iostream>
+# include <string>
+# include <vector>
+
+# include "expert-system.hpp"
+# include "knowledge_base.hpp"
+
+
+/*
+ * Stream
+ *
+ * Answers newline delimited JSON records against one rule file, e.g.
+ *   {"id": 1, "facts": "AB", "queries": "CD"}
+ * Every field is optional: facts and queries default to the file's `=` and
+ * `?` lines, and id is echoed back as given. Other fields are ignored.
+ * Every non blank line gets exactly one line back, in input order:
+ *   {"id":1,"results":{"C":"True","D":"Undetermined"}}
+ *   {"id":1,"error":"Invalid fact: a"}
+ * A query that ends in an error answers "Error".
+ * */
+struct StreamRecord {
+    std::string id = "null"; // raw JSON of the id field
+    uint32_t facts = 0;
+    std::vector<Query> queries;
+    std::string error;       // set when the line could not be read
+};
+
+StreamRecord parseStreamRecord(const RuleFile &file, const std::string &line);
+std::string answerStreamRecord(const RuleFile &file, const StreamRecord &record);
+// {"id":id,"error":"message"}, id is raw JSON
+std::string streamError(const std::string &id, const std::string &message);
+
+// Both of the above, for a single line
+std::string handleStreamRecord(const RuleFile &file, const std::string &line);
+
+// Answers the records of in on out until EOF. Reading, solving (on opts.jobs
+// threads) and writing run on separate threads, out is flushed in batches.
+int runStream(const InputOptions &opts, std::istream &in, std::ostream &out);
+
+
+#endif /* STREAM_HPP */
@@ -0,0 +1,225 @@
+#ifndef THREAD_POOL_HPP
+# define THREAD_POOL_HPP
+
+# include <vector>
+# include <algorithm>
+# include <deque>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <functional>
+# include <future>
+# include <memory>
+# include <atomic>
+# include <optional>
+
+
+// Fixed size pool of worker threads fed from a single FIFO queue.
+// The destructor drains the queue before joining the workers.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads) {
+        if (threads == 0)
+            threads = 1;
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this] { work(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename F>
+    auto submit(F &&f) -> std::future<decltype(f())> {
+        using R = decltype(f());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        std::future<R> res = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back([task] { (*task)(); });
+        }
+        cv.notify_one();
+        return res;
+    }
+
+    size_t size() const { return workers.size(); }
+
+private:
+    void work() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stopping = false;
+};
+
+
+// Blocking FIFO with a capacity, push waits while it is full. Once closed,
+// pop drains what is left and then returns nullopt.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(T value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(value));
+        not_empty.notify_one();
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return std::nullopt;
+        T value = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return value;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    bool closed = false;
+};
+
+
+// Runs tasks 0..n-1 on the calling thread plus up to `threads - 1` workers
+// of pool. A task starts once all the tasks it waits on are done: pending[t]
+// counts them and dependents[t] lists the tasks waiting on t. Each worker
+// owns a deque, the tasks a finished task releases go to the back of the
+// worker's own deque, idle workers steal from the front of the others and
+// sleep while every deque is empty. Pool workers busy elsewhere never join,
+// the calling thread alone can run every task. `work` must not throw.
+inline void runTaskGraph(ThreadPool &pool, size_t threads,
+        const std::vector<std::vector<size_t>> &dependents,
+        const std::vector<size_t> &pending,
+        const std::function<void(size_t)> &work) {
+    const size_t n = pending.size();
+    threads = std::max<size_t>(1, std::min({threads, n, pool.size() + 1}));
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+    // shared with the helpers, one still queued in the pool may start after
+    // this function returned
+    struct Run {
+        std::vector<Queue> queues;
+        std::unique_ptr<std::atomic<size_t>[]> waiting;
+        std::mutex mutex;           // guards what follows
+        std::condition_variable cv;
+        size_t queued = 0;          // tasks in the deques, not yet claimed
+        size_t done = 0;
+        size_t helpers = 0;         // pool workers inside worker()
+        bool closed = false;        // the caller is done, late helpers leave
+    };
+    auto run = std::make_shared<Run>();
+    run->queues = std::vector<Queue>(threads);
+    run->waiting.reset(new std::atomic<size_t>[n]);
+    for (size_t t = 0; t < n; t++) {
+        run->waiting[t].store(pending[t], std::memory_order_relaxed);
+        if (pending[t] == 0)
+            run->queues[run->queued++ % threads].tasks.push_back(t);
+    }
+
+    auto worker = [&, n](Run &r, size_t self) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(r.mutex);
+                r.cv.wait(lock, [&] { return r.queued > 0 || r.done == n; });
+                if (r.queued == 0)
+                    return;
+                r.queued--;
+            }
+            // a claimed task is in some deque, the loop only repeats when
+            // it was pushed behind the scan
+            std::optional<size_t> task;
+            for (size_t k = 0; !task; k = (k + 1) % threads) {
+                Queue &q = r.queues[(self + k) % threads];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.tasks.empty())
+                    continue;
+                if (k == 0) {
+                    task = q.tasks.back();
+                    q.tasks.pop_back();
+                } else {
+                    task = q.tasks.front();
+                    q.tasks.pop_front();
+                }
+            }
+
+            work(*task);
+            size_t released = 0;
+            for (size_t d : dependents[*task]) {
+                if (r.waiting[d].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(r.queues[self].mutex);
+                    r.queues[self].tasks.push_back(d);
+                    released++;
+                }
+            }
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.queued += released;
+            if (++r.done == n || released > 1)
+                r.cv.notify_all();
+            else if (released == 1)
+                r.cv.notify_one();
+        }
+    };
+
+    for (size_t i = 1; i < threads; i++) {
+        pool.submit([run, i, &worker] {
+            {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                if (run->closed)
+                    return;
+                run->helpers++;
+            }
+            worker(*run, i);
+            std::lock_guard<std::mutex> lock(run->mutex);
+            run->helpers--;
+            run->cv.notify_all();
+        });
+    }
+    worker(*run, 0);
+    std::unique_lock<std::mutex> lock(run->mutex);
+    run->closed = true;
+    run->cv.wait(lock, [&] { return run->helpers == 0; });
+}
+
+
+#endif /* THREAD_POOL_HPP */
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+
+#include "batch.hpp"
+#include "parser.hpp"
+#include "thread_pool.hpp"
+
+
+namespace {
+
+const size_t WINDOW_PER_THREAD = 64; // files solved ahead of the writer
+
+// Workers live for the whole batch, so each keeps one read buffer and only
+// grows it when a file is bigger than every one before. That buffer is all
+// they reuse: tokens, rules and the digraph of a file come from the default
+// allocator and are freed with it
+bool readFile(const std::string &path, std::string &buffer) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    const std::streamsize size = file.tellg();
+    if (size < 0)
+        return false;
+    file.seekg(0);
+    buffer.resize(size);
+    return bool(file.read(buffer.data(), size));
+}
+
+} // namespace
+
+
+std::vector<std::string> listBatchFiles(const std::string &path) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+
+    if (path != "-" && fs::is_directory(path)) {
+        for (const auto &entry : fs::directory_iterator(path)) {
+            if (entry.is_regular_file())
+                files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    std::ifstream list;
+    if (path != "-") {
+        list.open(path);
+        if (!list)
+            throw std::runtime_error("Cannot open file \"" + path + "\"");
+    }
+    std::istream &in = path == "-" ? std::cin : list;
+    std::string line;
+    while (std::getline(in, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty() && line[0] != '#')
+            files.push_back(line);
+    }
+    return files;
+}
+
+
+BatchResult solveBatchFile(const InputOptions &opts, const std::string &path) {
+    thread_local std::string input;
+    std::ostringstream out;
+    try {
+        if (!readFile(path, input))
+            throw std::runtime_error("Cannot open file \"" + path + "\"");
+
+        std::vector<Token> tokens = tokenizer(input);
+        auto [rules, facts, queries] = opts.isLazy
+            ? parseTokensQueryCone(tokens) : parseTokens(tokens);
+        Digraph digraph = makeDigraph(facts, rules, queries);
+        digraph.isExplain = opts.isExplain;
+        digraph.applyWorldAssumption(opts.isOpenWorldAssumption);
+
+        // the threads already go to other files
+        auto [conclusion, explanation, isError] = digraph.solveEverythingNoThrow(queries);
+
+        if (opts.isDot) {
+            digraph.writeDot(out, queryCone(queries, opts.dotDepth, opts.dotFanIn));
+            return {out.str(), 0};
+        }
+        if (opts.isExplain)
+            out << "CONCLUSION\n"  << conclusion << "\n"
+                << "EXPLANATION\n" << explanation << "\n";
+        else
+            out << conclusion;
+        return {out.str(), isError ? 1 : 0};
+    } catch (std::exception &e) {
+        out << "Error: " << e.what() << "\n";
+        return {out.str(), 1};
+    }
+}
+
+
+int runBatch(const InputOptions &opts, std::ostream &out) {
+    std::vector<std::string> files;
+    try {
+        files = listBatchFiles(opts.batch);
+    } catch (std::exception &e) {
+        std::cerr << "Startup error | " << e.what() << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(opts.jobs);
+    const size_t window = pool.size() * WINDOW_PER_THREAD;
+    std::deque<std::future<BatchResult>> pending;
+    int status = 0;
+    size_t written = 0;
+
+    auto writeNext = [&] {
+        BatchResult res = pending.front().get();
+        pending.pop_front();
+        out << "==> " << files[written++] << " <== " << res.status << "\n" << res.output;
+        status = std::max(status, res.status);
+    };
+
+    for (const auto &file : files) {
+        if (pending.size() >= window)
+            writeNext();
+        pending.push_back(pool.submit([&opts, &file] { return solveBatchFile(opts, file); }));
+    }
+    while (!pending.empty())
+        writeNext();
+    out.flush();
+    return status;
+}
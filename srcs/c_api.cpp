@@ -0,0 +1,98 @@
+#include <cstring>
+
+#include "expert-system.h"
+#include "knowledge_base.hpp"
+
+struct es_kb {
+    KnowledgeBase kb;
+};
+
+
+static void setError(char *err, size_t err_size, const char *what) {
+    if (!err || err_size == 0)
+        return;
+    std::strncpy(err, what, err_size - 1);
+    err[err_size - 1] = '\0';
+}
+
+static es_state toCState(Fact::State state) {
+    switch (state) {
+        case Fact::State::True:  return ES_TRUE;
+        case Fact::State::False: return ES_FALSE;
+        default:                 return ES_UNDETERMINED;
+    }
+}
+
+static void copyResult(const KnowledgeBase::Result &res, es_state *out) {
+    for (size_t i = 0; i < res.states.size(); i++)
+        out[i] = res.errors[i] ? ES_ERROR : toCState(res.states[i]);
+}
+
+
+extern "C" {
+
+es_kb *es_kb_load_text(const char *rules, char *err, size_t err_size) {
+    try {
+        return new es_kb{KnowledgeBase::fromText(rules ? rules : "")};
+    } catch (const std::exception &e) {
+        setError(err, err_size, e.what());
+    }
+    return nullptr;
+}
+
+es_kb *es_kb_load_compiled(const uint8_t *bytes, size_t size, char *err, size_t err_size) {
+    try {
+        if (!bytes)
+            throw std::runtime_error("No compiled rules");
+        return new es_kb{KnowledgeBase::fromBytes(bytes, size)};
+    } catch (const std::exception &e) {
+        setError(err, err_size, e.what());
+    }
+    return nullptr;
+}
+
+size_t es_kb_compile(const es_kb *kb, uint8_t *buf, size_t buf_size) {
+    if (!kb)
+        return 0;
+    try {
+        auto bytes = kb->kb.serialize();
+        if (buf && bytes.size() <= buf_size)
+            std::memcpy(buf, bytes.data(), bytes.size());
+        return bytes.size();
+    } catch (const std::exception &) {
+        return 0;
+    }
+}
+
+int es_kb_evaluate(const es_kb *kb, uint32_t facts, const char *queries,
+        es_state *out, size_t out_size, char *err, size_t err_size) {
+    return es_kb_evaluate_batch(kb, &facts, 1, queries, out, out_size, err, err_size);
+}
+
+int es_kb_evaluate_batch(const es_kb *kb, const uint32_t *facts, size_t count,
+        const char *queries, es_state *out, size_t out_size, char *err, size_t err_size) {
+    try {
+        if (!kb || !queries || (count && (!facts || !out)))
+            throw std::invalid_argument("Null argument");
+        auto query_list = KnowledgeBase::queryList(queries);
+        // divided rather than multiplied, a huge count must not wrap around
+        if (count && query_list.size() > out_size / count)
+            throw std::length_error("Output buffer too small");
+
+        auto results = count == 1
+            ? std::vector{kb->kb.evaluate(facts[0], query_list)}
+            : kb->kb.evaluateBatch(std::vector<uint32_t>(facts, facts + count), query_list);
+        for (size_t i = 0; i < count; i++)
+            copyResult(results[i], out + i * query_list.size());
+        return query_list.size();
+    } catch (const std::exception &e) {
+        setError(err, err_size, e.what());
+    }
+    return -1;
+}
+
+void es_kb_free(es_kb *kb) {
+    delete kb;
+}
+
+} // extern "C"
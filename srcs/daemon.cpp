@@ -0,0 +1,255 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <thread>
+
+#include "daemon.hpp"
+#include "parser.hpp"
+#include "thread_pool.hpp"
+
+using namespace daemon_protocol;
+
+static std::string g_socket_path;
+
+
+/* ** wire helpers ** */
+
+namespace {
+
+struct Reader {
+    const std::string &data;
+    size_t pos = 0;
+
+    uint64_t read(size_t bytes) {
+        if (pos + bytes > data.size())
+            throw std::runtime_error("Request too short");
+        uint64_t v = 0;
+        for (size_t i = 0; i < bytes; i++)
+            v |= uint64_t(uint8_t(data[pos++])) << (8 * i);
+        return v;
+    }
+};
+
+void write(std::string &out, uint64_t v, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+        out.push_back(char(v >> (8 * i)));
+}
+
+uint8_t stateByte(const KnowledgeBase::Result &res, size_t i) {
+    if (res.errors[i])
+        return 3;
+    switch (res.states[i]) {
+        case Fact::State::False: return 0;
+        case Fact::State::True:  return 1;
+        default:                 return 2;
+    }
+}
+
+std::string evaluate(const std::vector<RuleFile> &kbs, Reader &in) {
+    const size_t id = in.read(2);
+    const uint32_t set = in.read(4);
+    const uint32_t clear = in.read(4);
+    const size_t n = in.read(1);
+    if (id >= kbs.size())
+        throw std::runtime_error("Unknown knowledge base " + std::to_string(id));
+    const RuleFile &kb = kbs[id];
+
+    std::vector<Query> queries;
+    for (size_t i = 0; i < n; i++) {
+        const char c = in.read(1);
+        if (c < 'A' || c > 'Z')
+            throw std::runtime_error("Invalid query: " + std::string(1, c));
+        queries.push_back(Query(c));
+    }
+    if (in.pos != in.data.size())
+        throw std::runtime_error("Trailing bytes in request");
+
+    auto res = kb.kb.evaluate((kb.facts | set) & ~clear, n ? queries : kb.queries);
+    std::string out(1, OK);
+    write(out, res.states.size(), 1);
+    for (size_t i = 0; i < res.states.size(); i++)
+        out.push_back(stateByte(res, i));
+    return out;
+}
+
+} // namespace
+
+
+std::string handleDaemonRequest(const std::vector<RuleFile> &kbs, const std::string &request) {
+    try {
+        Reader in{request};
+        switch (in.read(1)) {
+            case EVALUATE:
+                return evaluate(kbs, in);
+            case LIST: {
+                std::string out(1, OK);
+                write(out, kbs.size(), 2);
+                for (const auto &kb : kbs) {
+                    const std::string name = kb.name.substr(0, 255);
+                    write(out, name.size(), 1);
+                    out += name;
+                }
+                return out;
+            }
+            default:
+                throw std::runtime_error("Unknown opcode");
+        }
+    } catch (const std::exception &e) {
+        return std::string(1, ERROR) + e.what();
+    }
+}
+
+
+/* ** socket side ** */
+
+static bool readExact(int fd, char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(fd, buf, size, 0);
+        if (n <= 0)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Requests of one connection are answered in order until it closes, sends
+// a message over MAX_MESSAGE or times out
+static void serveConnection(int client, const std::vector<RuleFile> &kbs) {
+    char header[4];
+    while (readExact(client, header, 4)) {
+        uint32_t size = 0;
+        for (int i = 0; i < 4; i++)
+            size |= uint32_t(uint8_t(header[i])) << (8 * i);
+        if (size > MAX_MESSAGE)
+            break;
+        std::string request(size, '\0');
+        if (!readExact(client, request.data(), size))
+            break;
+
+        std::string response = handleDaemonRequest(kbs, request);
+        std::string frame;
+        write(frame, response.size(), 4);
+        if (!writeAll(client, frame + response))
+            break;
+    }
+    close(client);
+}
+
+int bindDaemonSocket(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("socket path too long");
+    std::strcpy(addr.sun_path, path.c_str());
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            throw std::runtime_error(path + " exists and is not a socket");
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        const bool isLive = probe >= 0 && connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+        if (probe >= 0)
+            close(probe);
+        if (isLive)
+            throw std::runtime_error("a daemon already listens on " + path);
+        // left behind by a daemon that did not exit cleanly
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        const std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error(path + ": " + error);
+    }
+    return fd;
+}
+
+void serveDaemon(int server_fd, const std::vector<RuleFile> &kbs, int idleSeconds) {
+    // MAX_CONNECTIONS threads serve one connection each, the next ones wait
+    // in the queue and past that in the listen backlog
+    BoundedQueue<int> clients(MAX_CONNECTIONS);
+    for (size_t i = 0; i < MAX_CONNECTIONS; i++) {
+        std::thread([&clients, &kbs] {
+            while (auto client = clients.pop())
+                serveConnection(*client, kbs);
+        }).detach();
+    }
+
+    // a client silent for idleSeconds, or not reading its answers, gets its
+    // connection closed, idle ones cannot hold every thread
+    const timeval idle{idleSeconds, 0};
+    while (true) {
+        int client = accept(server_fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            // out of descriptors or memory, retrying at once would spin
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+        clients.push(client);
+    }
+}
+
+static void handleDaemonSignal(int) {
+    unlink(g_socket_path.c_str());
+    _exit(0);
+}
+
+void runDaemon(const InputOptions &opts) {
+    std::vector<RuleFile> kbs;
+    for (char *file : opts.files) {
+        try {
+            kbs.push_back(loadRuleFile(file));
+        } catch (const std::exception &e) {
+            std::cerr << "Startup error | " << file << ": " << e.what() << std::endl;
+            exit(1);
+        }
+    }
+    if (kbs.empty()) {
+        std::cerr << "Startup error | the daemon needs at least one rule file" << std::endl;
+        exit(1);
+    }
+
+    int server_fd;
+    try {
+        server_fd = bindDaemonSocket(opts.daemonSocket);
+    } catch (const std::exception &e) {
+        std::cerr << "Startup error | " << e.what() << std::endl;
+        exit(1);
+    }
+
+    g_socket_path = opts.daemonSocket;
+    std::signal(SIGINT, handleDaemonSignal);
+    std::signal(SIGTERM, handleDaemonSignal);
+
+    std::cout << "Daemon serving " << kbs.size() << " knowledge base(s) on "
+              << opts.daemonSocket << std::endl;
+    for (size_t i = 0; i < kbs.size(); i++)
+        std::cout << "  " << i << ": " << kbs[i].name << std::endl;
+
+    serveDaemon(server_fd, kbs, opts.keepAlive);
+}
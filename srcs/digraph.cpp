@@ -1,39 +1,53 @@
 #include <set>
+#include <unordered_set>
 #include <functional>
+#include <utility>
 
 #include "expert-system.hpp"
 #include "vector_helper.hpp"
+#include "thread_pool.hpp"
 
 Digraph::SolveRes Digraph::solveEverythingNoThrow(const std::vector<Query> &queries) {
     std::ostringstream conclusion;
     std::ostringstream explanation;
     bool isError = false;
+    auto &compiled_expressions = context.compiled_expressions;
     for (const auto &query : queries) {
         auto e = compileExprForFact(query.label);
-        compiled_expressions.insert({query.label, e});
+        compiled_expressions.insert({query.label, std::make_shared<const Expr>(std::move(e))});
     }
     for (const auto &fact : facts) {
         if (compiled_expressions.find(fact.second.id) == compiled_expressions.end()) {
             auto e = compileExprForFact(fact.second.id);
-            compiled_expressions.insert({fact.second.id, e});
+            compiled_expressions.insert({fact.second.id, std::make_shared<const Expr>(std::move(e))});
         }
     }
-    for (const auto &query : queries) {
-        try {
-            auto res = solveForFact(query.label);
-            auto expr = compiled_expressions.at(query.label);
-            auto table = boolMapEvaluate(expr);
-            res = determinFinalState(res, table, query.label);
-            conclusion << query.label << " is " << res << std::endl;
-            explanation << query.label << " ⇔ " << std::visit(PrinterFormalLogic{}, expr) << std::endl;
-            explanation << table << std::endl;
-        } catch (const std::exception &e) {
-            conclusion << query << " Error: " << e.what() << std::endl;
-            isError = true;
+    const bool isUpdate = updated.has_value() && answers.size() == queries.size();
+    for (size_t i = 0; i < queries.size(); i++) {
+        const auto &query = queries[i];
+        // the context already holds what answering it did
+        if (isUpdate && !(*updated & (1u << (query.label - 'A')))) {
+            conclusion << answers[i].conclusion;
+            explanation << answers[i].explanation;
+            isError = isError || answers[i].isError;
+            continue;
         }
+        const auto &expr = *compiled_expressions.at(query.label);
+        std::ostringstream query_conclusion, query_explanation;
+        bool ok = answerQuery(context, query, expr, query_conclusion, query_explanation).has_value();
+        Answer answer{query_conclusion.str(), query_explanation.str(), !ok};
+        conclusion << answer.conclusion;
+        explanation << answer.explanation;
+        isError = isError || answer.isError;
+        if (i < answers.size())
+            answers[i] = std::move(answer);
+        else
+            answers.push_back(std::move(answer));
     }
+    answers.resize(queries.size());
+    updated.reset();
     if (isExplain) {
-        explanation << "OPERATIONS\n" << this->explanation.str();
+        explanation << "OPERATIONS\n" << context.explanation.str();
         // explanation << "USELESS RUELS\n";
         // for (auto r : useless_rules) {
         //     explanation << r << "\n";
@@ -42,7 +56,122 @@ Digraph::SolveRes Digraph::solveEverythingNoThrow(const std::vector<Query> &quer
     return {conclusion.str(), explanation.str(), isError};
 }
 
-Fact::State Digraph::determinFinalState(Fact::State solverRes, const VarBoolMap &boolMap, char fact_id) {
+std::vector<Digraph::QueryGroup> Digraph::groupQueries(const std::vector<Query> &queries) const {
+    std::vector<QueryGroup> groups;
+    for (size_t i = 0; i < queries.size(); i++) {
+        QueryGroup merged{dependencyCone(queries[i].label), {i}};
+        for (auto g = groups.begin(); g != groups.end();) {
+            if (g->cone & merged.cone) {
+                merged.cone |= g->cone;
+                merged.queries = merged.queries + g->queries;
+                g = groups.erase(g);
+            } else {
+                g++;
+            }
+        }
+        std::sort(merged.queries.begin(), merged.queries.end());
+        groups.push_back(merged);
+    }
+    return groups;
+}
+
+Digraph::SolveRes Digraph::solveQueriesParallel(const std::vector<Query> &queries, size_t jobs) const {
+    // The solver's answers depend on what earlier queries left behind, so
+    // queries whose cones overlap are kept together and solved in order in
+    // one context. Only disjoint groups run concurrently.
+    std::vector<QueryGroup> groups = groupQueries(queries);
+
+    struct Answer {
+        std::string conclusion;
+        std::string explanation;
+        bool isError;
+    };
+    std::vector<Answer> answers(queries.size());
+    std::vector<std::string> operations(groups.size());
+
+    {
+        // threads left over by the groups go to solving inside them, from
+        // the same pool
+        ThreadPool pool(jobs);
+        std::vector<std::future<void>> done;
+        for (size_t g = 0; g < groups.size(); g++) {
+            done.push_back(pool.submit([this, &queries, &answers, &operations, &group = groups[g], g, &groups, jobs, &pool] {
+                SolveContext ctx = newContext();
+                ctx.jobs = std::max<size_t>(1, jobs / groups.size());
+                ctx.pool = &pool;
+                std::vector<Expr> exprs;
+                for (size_t i : group.queries)
+                    exprs.push_back(compileExprForFact(ctx, queries[i].label));
+                for (size_t n = 0; n < group.queries.size(); n++) {
+                    const size_t i = group.queries[n];
+                    std::ostringstream conclusion, explanation;
+                    bool ok = answerQuery(ctx, queries[i], exprs[n], conclusion, explanation).has_value();
+                    answers[i] = {conclusion.str(), explanation.str(), !ok};
+                }
+                operations[g] = ctx.explanation.str();
+            }));
+        }
+        for (auto &d : done)
+            d.get();
+    }
+
+    std::string conclusion, explanation;
+    bool isError = false;
+    for (const auto &a : answers) {
+        conclusion += a.conclusion;
+        explanation += a.explanation;
+        isError = isError || a.isError;
+    }
+    if (isExplain) {
+        explanation += "OPERATIONS\n" + context.explanation.str();
+        for (const auto &ops : operations)
+            explanation += ops;
+    }
+    return {conclusion, explanation, isError};
+}
+
+// Mask of the facts solving fact_id can read or write, the fact itself and
+// everything it transitively depends on.
+uint32_t Digraph::dependencyCone(char fact_id) const {
+    uint32_t cone = 0;
+    std::vector<char> todo = {fact_id};
+    while (!todo.empty()) {
+        const char f = todo.back();
+        todo.pop_back();
+        const uint32_t bit = 1u << (f - 'A');
+        if (cone & bit)
+            continue;
+        cone |= bit;
+        auto deps = dependencies.find(f);
+        if (deps != dependencies.end())
+            todo.insert(todo.end(), deps->second.begin(), deps->second.end());
+    }
+    return cone;
+}
+
+// Solves the query and checks the result against the truth table of its
+// compiled expression. Returns nullopt if the query ended in an error.
+std::optional<Fact::State> Digraph::answerQuery(SolveContext &ctx, const Query &query, const Expr &expr,
+        std::ostream &conclusion, std::ostream &explanation) const {
+    Fact::State res;
+    try {
+        if (frozen)
+            solveInDependencyOrder(ctx, query.label);
+        res = solveForFact(ctx, query.label);
+        auto table = boolMapEvaluate(ctx, expr);
+        res = determinFinalState(ctx, res, table, query.label);
+        conclusion << query.label << " is " << res << std::endl;
+        explanation << query.label << " ⇔ " << std::visit(PrinterFormalLogic{}, expr) << std::endl;
+        explanation << table << std::endl;
+    } catch (const std::exception &e) {
+        conclusion << query << " Error: " << e.what() << std::endl;
+        return std::nullopt;
+    }
+    return res;
+}
+
+Fact::State Digraph::determinFinalState(SolveContext &ctx, Fact::State solverRes, const VarBoolMap &boolMap, char fact_id) const {
+    auto &explanation = ctx.explanation;
   
     if (!boolMap.contains(fact_id)) {
         if (isExplain)
@@ -102,20 +231,161 @@ Fact::State Digraph::determinFinalState(Fact::State solverRes, const VarBoolMap
 
 
 void Digraph::applyWorldAssumption(bool open) {
+    applyWorldAssumption(context, open);
+    for (auto &[fact_id, fact]: facts)
+        fact.state = context.states.get(fact_id);
+}
+
+void Digraph::applyWorldAssumption(SolveContext &ctx, bool open) const {
+    auto &explanation = ctx.explanation;
     if (open) {
         if (isExplain) {
             explanation << "Applying Open World Assumption: Facts are Undetermined by default" << std::endl;
         }
         return ;
     }
-    for (auto &[fact_id, fact]: facts) {
-        if (fact.state == Fact::State::Undetermined && fact.consequent_rules.empty()) {
+    for (const auto &[fact_id, fact]: facts) {
+        if (ctx.states.get(fact_id) == Fact::State::Undetermined && fact.consequent_rules.empty()) {
             if (isExplain) {
                 explanation << "Applying Closed World Assumption: " << fact_id << " = False (no rules can prove it)" << std::endl;
             }
-            fact.state = Fact::State::False;
+            setFactState(ctx, fact_id, Fact::State::False);
+        }
+    }
+}
+
+
+FactStates Digraph::startingStates() const {
+    FactStates start;
+    for (const auto &[id, fact] : facts)
+        start.set(id, fact.state);
+    return start;
+}
+
+
+uint32_t Digraph::resetToStart(SolveContext &ctx, const FactStates &from, const FactStates &to,
+        const std::vector<Query> &queries, bool all) const {
+    const uint32_t changed = (from.known ^ to.known) | (from.truth ^ to.truth);
+
+    // Which of two facts is searched first can change an answer, and a
+    // changed fact can change the order its query searches the others in.
+    // A group of queries sharing facts is therefore reset as a whole, its
+    // queries are answered again in order, as solveQueriesParallel has it.
+    uint32_t reset = changed;
+    for (const auto &group : groupQueries(queries)) {
+        if (all || (group.cone & changed))
+            reset |= group.cone;
+    }
+    if (!reset)
+        return 0;
+
+    for (const auto &[id, _] : facts) {
+        if (!(reset & (1u << (id - 'A'))))
+            continue;
+        ctx.states.set(id, to.get(id));
+        ctx.settled.erase(id);
+        ctx.defered_set_false.erase(id);
+        ctx.compiled_expressions.erase(id);
+        // the rules concluding it, consequent_rules mirrors consequent_facts
+        for (const auto &r : facts.at(id).consequent_rules)
+            ctx.useless_rules.erase(r);
+    }
+    // expressions are compiled from the starting states, as a first solve has them
+    SolveContext start;
+    start.states = to;
+    for (const auto &[id, _] : facts) {
+        if (reset & (1u << (id - 'A')))
+            ctx.compiled_expressions.insert({id, std::make_shared<const Expr>(compileExprForFact(start, id))});
+    }
+    ctx.solving_stack.clear();
+    ctx.epoch++;
+    return reset;
+}
+
+
+uint32_t Digraph::updateFacts(const std::vector<Fact> &given,
+        const std::vector<Query> &queries, bool open) {
+    FactStates to;
+    for (const auto &[id, fact] : facts) {
+        if (!open && fact.consequent_rules.empty())
+            to.set(id, Fact::State::False);
+    }
+    for (const auto &f : given) {
+        if (facts.contains(f.id))
+            to.set(f.id, Fact::State::True);
+    }
+    const uint32_t reset = resetToStart(context, startingStates(), to, queries, false);
+    for (auto &[id, fact] : facts)
+        fact.state = to.get(id);
+    updated = reset;
+    return reset;
+}
+
+
+Digraph::SolveRes Digraph::Snapshot::result() const {
+    SolveRes res{"", "", false};
+    if (!answers)
+        return res;
+    for (const auto &a : *answers) {
+        res.conlusion += a.conclusion;
+        res.explanation += a.explanation;
+        res.isError = res.isError || a.isError;
+    }
+    return res;
+}
+
+
+Digraph::Snapshot Digraph::snapshot() const {
+    return {
+        startingStates(),
+        std::make_shared<const SolveContext>(context.fork()),
+        answers.empty() ? nullptr : std::make_shared<const std::vector<Answer>>(answers)
+    };
+}
+
+
+Digraph::Snapshot Digraph::whatIf(const Snapshot &snap, uint32_t set_true, uint32_t set_false,
+        const std::vector<Query> &queries) const {
+    if (set_true & set_false)
+        throw std::invalid_argument("A fact can't be both True and False");
+    FactStates to = snap.start;
+    for (const auto &[id, _] : facts) {
+        const uint32_t bit = 1u << (id - 'A');
+        if (set_true & bit)
+            to.set(id, Fact::State::True);
+        else if (set_false & bit)
+            to.set(id, Fact::State::False);
+    }
+
+    // the snapshot may hold a context no query was answered on
+    const bool all = !snap.answers || snap.answers->size() != queries.size();
+    const uint32_t changed = (snap.start.known ^ to.known) | (snap.start.truth ^ to.truth);
+    bool isAnswered = !all;
+    for (const auto &q : queries)
+        isAnswered = isAnswered && !(dependencyCone(q.label) & changed);
+    // no query can see the change, the fork keeps sharing what snap solved
+    if (isAnswered)
+        return {to, snap.solved, snap.answers};
+
+    // a layer over snap's context, answering in place would change snap
+    SolveContext ctx = SolveContext::overlay(snap.solved);
+    const uint32_t reset = resetToStart(ctx, snap.start, to, queries, all);
+    std::vector<Answer> res;
+    for (size_t i = 0; i < queries.size(); i++) {
+        if (!all && !(reset & (1u << (queries[i].label - 'A')))) {
+            res.push_back((*snap.answers)[i]);
+            continue;
         }
+        std::ostringstream conclusion, explanation;
+        bool ok = answerQuery(ctx, queries[i], *ctx.compiled_expressions.at(queries[i].label),
+            conclusion, explanation).has_value();
+        res.push_back({conclusion.str(), explanation.str(), !ok});
     }
+    return {
+        to,
+        std::make_shared<const SolveContext>(std::move(ctx)),
+        std::make_shared<const std::vector<Answer>>(std::move(res))
+    };
 }
 
 
@@ -124,7 +394,9 @@ std::string Digraph::toString() const {
 
     res += "Facts (" + std::to_string(facts.size()) + "):\n";
     for (const auto &kv : facts) {
-        res += "- " + kv.second.toString() + "\n";
+        Fact fact = kv.second;
+        fact.state = context.states.get(kv.first);
+        res += "- " + fact.toString() + "\n";
     }
 
     res += "Rules (" + std::to_string(rules.size()) + "):\n";
@@ -137,53 +409,83 @@ std::string Digraph::toString() const {
 
 
 std::string Digraph::toDot() const {
-    std::stringstream ss;
-
-    ss << "strict digraph {\n";
-
-    for (const auto &kv : facts) {
-        auto fact = kv.second;
+    std::ostringstream ss;
+    writeDot(ss);
+    return ss.str();
+}
 
-        if (fact.consequent_rules.size() == 0) {
-            ss << "  " << kv.first << "\n";
-        } else for (const auto &r: fact.consequent_rules) {
-            ss << "  " << kv.first << " -> \"" << r << "\"\n";
-            //ss << "  \"" << r << "\" -> " << kv.first << "\n";
-           (void)r;
+// Edges go from a fact to the rules concluding it and from a rule to the
+// facts it reads. The cone is walked first, breadth first so that a fact
+// gets its lowest level, then written in the order of the whole graph.
+void Digraph::writeDot(std::ostream &out, const DotOptions &options) const {
+    enum class Shown { Expanded, Cut, Collapsed };
+    const bool isWhole = options.queries.empty();
+    std::unordered_map<char, Shown> coneFacts;
+    std::unordered_set<std::string> coneRules;
+
+    std::vector<std::pair<char, size_t>> frontier; // fact and level
+    for (char q : options.queries) {
+        if (facts.count(q) && coneFacts.emplace(q, Shown::Expanded).second)
+            frontier.push_back({q, 0});
+    }
+    for (size_t i = 0; i < frontier.size(); i++) {
+        const auto [id, level] = frontier[i];
+        const Fact &fact = facts.at(id);
+        if (fact.consequent_rules.empty())
+            continue;
+        if (options.depth && level >= options.depth) {
+            coneFacts[id] = Shown::Cut;
+            continue;
         }
-
-        if (fact.antecedent_rules.size() == 0) {
-            //ss << "  " << kv.first << "\n";
-        } else for (const auto &r: fact.antecedent_rules) {
-            //ss << "  " << kv.first << " -> \"" << r << "\"\n";
-            //ss <<  " \"" << r << "\" -> " << kv.first << "\n";
-           (void)r;
+        if (options.maxFanIn && fact.consequent_rules.size() > options.maxFanIn) {
+            coneFacts[id] = Shown::Collapsed;
+            continue;
+        }
+        for (const auto &rule_id : fact.consequent_rules) {
+            auto rule = rules.find(rule_id);
+            if (rule == rules.end() || !coneRules.insert(rule_id).second)
+                continue;
+            for (char f : rule->second.antecedent_facts) {
+                if (facts.count(f) && coneFacts.emplace(f, Shown::Expanded).second)
+                    frontier.push_back({f, level + 1});
+            }
         }
     }
-    ss << "\n\n";
-
-    for (const auto &kv : rules) {
-        auto rule = kv.second;
 
-        if (rule.consequent_facts.size() == 0) {
-            //ss << "  \"" << kv.first << "\"\n";
-        } else for (const auto &f: rule.consequent_facts) {
-            //ss << "  \"" << kv.first << "\" -> " << f << "\n";
-            //ss << "  " << f << " -> \"" << kv.first << "\"\n";
-            (void)f;
+    out << "strict digraph {\n";
+
+    for (const auto &[id, fact] : facts) {
+        auto cone = coneFacts.find(id);
+        if (!isWhole && cone == coneFacts.end())
+            continue;
+        const Shown shown = isWhole ? Shown::Expanded : cone->second;
+        const size_t fanIn = fact.consequent_rules.size();
+
+        if (fanIn == 0) {
+            out << "  " << id << "\n";
+        } else if (shown == Shown::Cut) {
+            // its rules are past the depth
+            out << "  " << id << " [style=dashed]\n";
+        } else if (shown == Shown::Collapsed) {
+            out << "  \"" << id << ": " << fanIn << " rules\" [shape=box style=dashed]\n"
+                << "  " << id << " -> \"" << id << ": " << fanIn << " rules\"\n";
+        } else for (const auto &r : fact.consequent_rules) {
+            out << "  " << id << " -> \"" << r << "\"\n";
         }
+    }
+    out << "\n\n";
 
+    for (const auto &[id, rule] : rules) {
+        if (!isWhole && !coneRules.count(id))
+            continue;
         if (rule.antecedent_facts.size() == 0) {
-            ss << "  \"" << kv.first << "\"\n";
-        } else for (const auto &f: rule.antecedent_facts) {
-            ss << "  \"" << kv.first << "\" -> " << f << "\n";
-            //ss << "  " << f << " -> \"" << kv.first << "\"\n";
-            (void)f;
+            out << "  \"" << id << "\"\n";
+        } else for (const auto &f : rule.antecedent_facts) {
+            out << "  \"" << id << "\" -> " << f << "\n";
         }
     }
 
-    ss << "}\n";
-    return ss.str();
+    out << "}\n";
 }
 
 bool Digraph::isFactInAmbiguousConclusion(char fact_id) const {
@@ -209,9 +511,11 @@ bool Digraph::isFactInAmbiguousConclusion(char fact_id) const {
 }
 
 void Digraph::addFact(const Fact &fact) {
+    frozen = false;
     auto it = facts.find(fact.id);
     if (it == facts.end()) {
         (void)facts.insert({fact.id, fact});
+        context.states.set(fact.id, fact.state);
         return;
     }
 
@@ -234,11 +538,13 @@ void Digraph::addFact(const Fact &fact) {
         existing.antecedent_rules + fact.antecedent_rules);
     existing.consequent_rules = (
         existing.consequent_rules + fact.consequent_rules);
+    context.states.set(existing.id, existing.state);
     return;
 }
 
 
 void Digraph::addRule(const Rule &rule) {
+    frozen = false;
     auto it = rules.find(rule.id);
     if (it != rules.end()) {
         throw std::runtime_error("Duplicate rule");
@@ -310,24 +616,24 @@ void Digraph::addRule(const Rule &rule) {
     return;
 }
 
-void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
+void Digraph::setExprVarsToState(SolveContext &ctx, const Expr &expr, const Fact::State state) const {
     if (auto v = std::get_if<Var>(&expr)) {
         auto it = facts.find(v->value());
         if (it == facts.end()) {
             throw std::runtime_error("Fact not found, but must exist");
         }
-        Fact &fact(it->second);
+        const Fact::State current = ctx.states.get(it->first);
 
-        if (fact.state == Fact::State::Undetermined) {
-            fact.state = state;
-        } else if (fact.state == state || state == Fact::State::Undetermined) { // if same state or determined facts to undetermined
+        if (current == Fact::State::Undetermined) {
+            setFactState(ctx, it->first, state);
+        } else if (current == state || state == Fact::State::Undetermined) { // if same state or determined facts to undetermined
             // Same state, no problem
             return;
         } else {
             // Real contradiction
             std::stringstream ss;
-            ss << "Contradiction: Can't set fact " << fact << " to "
-               << state << " it's already " << fact.state;
+            ss << "Contradiction: Can't set fact " << it->first << ":" << current << " to "
+               << state << " it's already " << current;
             throw std::runtime_error(ss.str());
         }
         
@@ -339,7 +645,7 @@ void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
         return ;
     }
     else if (auto n = std::get_if<Not>(&expr)) {
-        setExprVarsToState(n->child(), state == Fact::State::True
+        setExprVarsToState(ctx, n->child(), state == Fact::State::True
                 ? Fact::State::False
                 : state == Fact::State::False
                     ? Fact::State::True
@@ -350,12 +656,12 @@ void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
         // And handling
         if (state == Fact::State::True) {
             // A + B = True means both A and B must be True
-            setExprVarsToState(and_expr->lhs(), Fact::State::True);
-            setExprVarsToState(and_expr->rhs(), Fact::State::True);
+            setExprVarsToState(ctx, and_expr->lhs(), Fact::State::True);
+            setExprVarsToState(ctx, and_expr->rhs(), Fact::State::True);
         } else if (state == Fact::State::False) {
             // A + B = False: we can't determine individual values
-            setExprVarsToState(and_expr->lhs(), Fact::State::Undetermined);
-            setExprVarsToState(and_expr->rhs(), Fact::State::Undetermined);
+            setExprVarsToState(ctx, and_expr->lhs(), Fact::State::Undetermined);
+            setExprVarsToState(ctx, and_expr->rhs(), Fact::State::Undetermined);
         }
         return;
     }
@@ -363,19 +669,19 @@ void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
         // Or handling  
         if (state == Fact::State::True) {
             // A | B = True: At least one must be true, so if one is false we know the other is true
-            Fact::State lhs_state = solveExpr(or_expr->lhs());
-            Fact::State rhs_state = solveExpr(or_expr->rhs());
+            Fact::State lhs_state = solveExpr(ctx, or_expr->lhs());
+            Fact::State rhs_state = solveExpr(ctx, or_expr->rhs());
     
-                 if (lhs_state == Fact::State::False) { setExprVarsToState(or_expr->rhs(), Fact::State::True); }
-            else if (rhs_state == Fact::State::False) { setExprVarsToState(or_expr->lhs(), Fact::State::True); }
+                 if (lhs_state == Fact::State::False) { setExprVarsToState(ctx, or_expr->rhs(), Fact::State::True); }
+            else if (rhs_state == Fact::State::False) { setExprVarsToState(ctx, or_expr->lhs(), Fact::State::True); }
             else {
-                setExprVarsToState(or_expr->lhs(), Fact::State::Undetermined);
-                setExprVarsToState(or_expr->rhs(), Fact::State::Undetermined);
+                setExprVarsToState(ctx, or_expr->lhs(), Fact::State::Undetermined);
+                setExprVarsToState(ctx, or_expr->rhs(), Fact::State::Undetermined);
             }
         } else if (state == Fact::State::False) {
             // A | B = False: Both A and B must be False
-            setExprVarsToState(or_expr->lhs(), Fact::State::False);
-            setExprVarsToState(or_expr->rhs(), Fact::State::False);
+            setExprVarsToState(ctx, or_expr->lhs(), Fact::State::False);
+            setExprVarsToState(ctx, or_expr->rhs(), Fact::State::False);
         }
         return;
     }
@@ -384,8 +690,8 @@ void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
             // Do nothing, nothing can be learnt from this, TODO: if we add fourth uninitialised state this changes
             return ;
         }
-        Fact::State lhs_state = solveExpr(xor_expr->lhs());
-        Fact::State rhs_state = solveExpr(xor_expr->rhs());
+        Fact::State lhs_state = solveExpr(ctx, xor_expr->lhs());
+        Fact::State rhs_state = solveExpr(ctx, xor_expr->rhs());
 
         if (lhs_state == Fact::State::Undetermined && lhs_state == Fact::State::Undetermined) {
             // Do nothing, nothing can be learnt from this, TODO: if we add fourth uninitialised state this changes
@@ -393,21 +699,21 @@ void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
         }
         if (state == Fact::State::True) {
             // A ^ B = True: exactly one must be true
-                 if (lhs_state == Fact::State::True) { setExprVarsToState(xor_expr->rhs(), Fact::State::False); }
-            else if (rhs_state == Fact::State::True) { setExprVarsToState(xor_expr->lhs(), Fact::State::False); }
+                 if (lhs_state == Fact::State::True) { setExprVarsToState(ctx, xor_expr->rhs(), Fact::State::False); }
+            else if (rhs_state == Fact::State::True) { setExprVarsToState(ctx, xor_expr->lhs(), Fact::State::False); }
 
-            else if (lhs_state == Fact::State::False) { setExprVarsToState(xor_expr->rhs(), Fact::State::True); }
-            else if (rhs_state == Fact::State::False) { setExprVarsToState(xor_expr->lhs(), Fact::State::True); }
+            else if (lhs_state == Fact::State::False) { setExprVarsToState(ctx, xor_expr->rhs(), Fact::State::True); }
+            else if (rhs_state == Fact::State::False) { setExprVarsToState(ctx, xor_expr->lhs(), Fact::State::True); }
 
             // Undetermined cases are handled above if you think about it
 
         } else if (state == Fact::State::False) {
             // A ^ B = False: both true or both false
-                 if (lhs_state == Fact::State::True) { setExprVarsToState(xor_expr->rhs(), Fact::State::True); }
-            else if (rhs_state == Fact::State::True) { setExprVarsToState(xor_expr->lhs(), Fact::State::True); }
+                 if (lhs_state == Fact::State::True) { setExprVarsToState(ctx, xor_expr->rhs(), Fact::State::True); }
+            else if (rhs_state == Fact::State::True) { setExprVarsToState(ctx, xor_expr->lhs(), Fact::State::True); }
 
-            else if (lhs_state == Fact::State::False) { setExprVarsToState(xor_expr->rhs(), Fact::State::False); }
-            else if (rhs_state == Fact::State::False) { setExprVarsToState(xor_expr->lhs(), Fact::State::False); }
+            else if (lhs_state == Fact::State::False) { setExprVarsToState(ctx, xor_expr->rhs(), Fact::State::False); }
+            else if (rhs_state == Fact::State::False) { setExprVarsToState(ctx, xor_expr->lhs(), Fact::State::False); }
         }
         return;
     }
@@ -421,7 +727,33 @@ void Digraph::setExprVarsToState(const Expr &expr, const Fact::State state) {
     // else throw not handled yet
 }
 
+// Tracks the nesting of solveForFact / solveExpr, the memo is only valid
+// within a single top-level solve
+struct SolveDepthGuard {
+    size_t &depth;
+    explicit SolveDepthGuard(SolveContext &ctx) : depth(ctx.solve_depth) {
+        if (depth++ == 0) {
+            ctx.memo.clear();
+            ctx.cycle_low = SIZE_MAX;
+        }
+    }
+    ~SolveDepthGuard() { depth--; }
+};
+
+void Digraph::setFactState(SolveContext &ctx, char fact_id, Fact::State state) const {
+    if (ctx.states.get(fact_id) == state)
+        return;
+    ctx.states.set(fact_id, state);
+    ctx.epoch++;
+}
+
 Fact::State Digraph::solveForFact(const char fact_id) {
+    return solveForFact(context, fact_id);
+}
+
+Fact::State Digraph::solveForFact(SolveContext &ctx, const char fact_id) const {
+    SolveDepthGuard depth(ctx);
+    auto &explanation = ctx.explanation;
     auto f = facts.find(fact_id);
     if (f == facts.end()){
         if (isClosedWorldAssumption) {
@@ -437,46 +769,58 @@ Fact::State Digraph::solveForFact(const char fact_id) {
         }
     }
 
-    Fact &fact(f->second);
+    const Fact &fact(f->second);
+
+    if (ctx.settled.contains(fact_id))
+        return ctx.states.get(fact_id);
 
     // Check for cycle
-    if (solving_stack.find(fact_id) != solving_stack.end()) {
+    auto &solving_stack = ctx.solving_stack;
+    auto on_stack = std::find(solving_stack.begin(), solving_stack.end(), fact_id);
+    if (on_stack != solving_stack.end()) {
         if (isExplain) {
             explanation << "Cycle detected for fact " << fact_id << ", deferring to other rules" << std::endl;
         }
         // Don't set to False immediately - return undetermined and let other rules try
+        ctx.cycle_low = std::min(ctx.cycle_low, static_cast<size_t>(on_stack - solving_stack.begin()));
         return Fact::State::Undetermined;
     }
 
     // Add to solving stack
-    solving_stack.insert(fact_id);
+    solving_stack.push_back(fact_id);
 
     for (const auto &r : fact.consequent_rules) {
         if (isExplain) {
             explanation << "solveForFact " << fact_id << ": solving " << r << std::endl;
         }
 
-        solveRule(r);
+        solveRule(ctx, r);
 
         // This mess is here to propagate undetermined facts which should be set at False
         // it uses a global useless rules list, rules that have false in 
         // the lhs & no interdependance (iff does not work) are marked and the lhs is set to False
         // unless it's already defined somewhere. It's not perfect but passes the
-        auto fact_it = facts.find(fact_id);
-        if (fact_it != facts.end() && fact_it->second.state == Fact::State::Undetermined && isLeafRule(r)) {
+        if (ctx.states.get(fact_id) == Fact::State::Undetermined && isLeafRule(ctx, r)) {
             auto rule_it = rules.find(r);
             if (rule_it == rules.end()) break;
             const Rule &rule = rule_it->second;
-            auto foo = rule.expr.getValues();
-            if (foo.lhs && foo.rhs) {
-                auto lhs_res = solveExpr(foo.lhs.value());
+            // sides by reference, solveExpr memoizes on the node addresses
+            const Expr *lhs = nullptr, *rhs = nullptr;
+            if (auto imply = std::get_if<Imply>(&rule.expr)) {
+                lhs = &imply->lhs(); rhs = &imply->rhs();
+            } else if (auto iff = std::get_if<Iff>(&rule.expr)) {
+                lhs = &iff->lhs(); rhs = &iff->rhs();
+            }
+            if (lhs && rhs) {
+                auto lhs_res = solveExpr(ctx, *lhs);
                 if (lhs_res == Fact::State::False) {
                     explanation << "" << r << " is a useless rule, adding rhs facts to defered false\n"; 
-                    useless_rules.insert(r);
-                    for (auto f : foo.rhs.value().getAllFacts()) {
-                        auto res = solveForFact(f);
-                        if (res == Fact::State::Undetermined) {
-                            defered_set_false.insert(f);
+                    if (ctx.useless_rules.insert(r))
+                        ctx.epoch++;
+                    for (auto f : rhs->getAllFacts()) {
+                        auto res = solveForFact(ctx, f);
+                        if (res == Fact::State::Undetermined && ctx.defered_set_false.insert(f).second) {
+                            ctx.epoch++;
                         }
                     }
                 }
@@ -485,23 +829,23 @@ Fact::State Digraph::solveForFact(const char fact_id) {
     }
 
     // Remove from solving stack
-    solving_stack.erase(fact_id);
+    solving_stack.pop_back();
 
-    if (defered_set_false.find(fact_id) != defered_set_false.end()) {
-        auto fact_it = facts.find(fact_id);
-        if (fact_it != facts.end() && fact_it->second.state == Fact::State::Undetermined ) {
-            fact_it->second.state = Fact::State::False;
-            defered_set_false.erase(fact_id);
+    if (ctx.defered_set_false.find(fact_id) != ctx.defered_set_false.end()) {
+        if (ctx.states.get(fact_id) == Fact::State::Undetermined) {
+            setFactState(ctx, fact_id, Fact::State::False);
+            ctx.defered_set_false.erase(fact_id);
         }
     }
 
-    return fact.state;
+    return ctx.states.get(fact_id);
 }
 
 // A rule is considered a "leaf" if
 // it has no rules that depend on its antecedent facts
 // it has 
-bool Digraph::isLeafRule(const std::string &rule_id) const {
+bool Digraph::isLeafRule(const SolveContext &ctx, const std::string &rule_id) const {
+    const auto &useless_rules = ctx.useless_rules;
     auto rule_it = rules.find(rule_id);
     if (rule_it == rules.end()) {
         throw std::runtime_error("Rule not found: " + rule_id);
@@ -515,8 +859,7 @@ bool Digraph::isLeafRule(const std::string &rule_id) const {
         const Fact &fact = fact_it->second;
         for (const auto &dependent_rule_id : fact.consequent_rules) {
             // Skip useless rules
-            if (std::find(useless_rules.begin(), useless_rules.end(), dependent_rule_id)
-                != useless_rules.end()) {
+            if (useless_rules.contains(dependent_rule_id)) {
                 continue;
             }
             // If this fact feeds into any non-useless rule, it's not a leaf
@@ -528,7 +871,7 @@ bool Digraph::isLeafRule(const std::string &rule_id) const {
 }
 
 // Helper function to count determined antecedents in a rule
-int Digraph::countDeterminedAntecedents(const std::string& rule_id) {
+int Digraph::countDeterminedAntecedents(const SolveContext &ctx, const std::string& rule_id) const {
     auto rule_it = rules.find(rule_id);
     if (rule_it == rules.end()) return 0;
 
@@ -536,8 +879,7 @@ int Digraph::countDeterminedAntecedents(const std::string& rule_id) {
     int determined_count = 0;
     
     for (char fact_id : antecedent_facts) {
-        auto fact_it = facts.find(fact_id);
-        if (fact_it != facts.end() && fact_it->second.state != Fact::State::Undetermined) {
+        if (facts.contains(fact_id) && ctx.states.get(fact_id) != Fact::State::Undetermined) {
             determined_count++;
         }
     }
@@ -546,23 +888,48 @@ int Digraph::countDeterminedAntecedents(const std::string& rule_id) {
 }
 
 Fact::State Digraph::solveRule(const std::string &rule_id) {
+    return solveRule(context, rule_id);
+}
+
+Fact::State Digraph::solveRule(SolveContext &ctx, const std::string &rule_id) const {
     auto r = rules.find(rule_id);
     if (r == rules.end()) {
         throw std::runtime_error("Rule not found!");
     }
 
-    Rule &rule(r->second);
-    auto res = solveExpr(rule.expr);
+    const Rule &rule(r->second);
+    auto res = solveExpr(ctx, rule.expr);
     if (isExplain) {
-        explanation << "solveRule " << rule_id << ": result " << res << std::endl;
+        ctx.explanation << "solveRule " << rule_id << ": result " << res << std::endl;
     }
     // TODO : should their be a check for rules that resolve to false, it should be illigal in this sytem, right?
     return res;
 }
 
 Fact::State Digraph::solveExpr(const Expr &expr) {
+    return solveExpr(context, expr);
+}
+
+Fact::State Digraph::solveExpr(SolveContext &ctx, const Expr &expr) const {
     struct Solver {
-        Digraph &digraph;
+        const Digraph &digraph;
+        SolveContext &ctx;
+
+        // visit through the memo, see SolveContext::memo
+        Fact::State eval(const Expr &e) {
+            auto it = ctx.memo.find(&e);
+            if (it != ctx.memo.end() && it->second.epoch == ctx.epoch)
+                return it->second.state;
+
+            const uint64_t epoch = ctx.epoch;
+            const size_t base = ctx.solving_stack.size();
+            const size_t outer_low = std::exchange(ctx.cycle_low, SIZE_MAX);
+            Fact::State res = std::visit(*this, e);
+            if (epoch == ctx.epoch && ctx.cycle_low >= base)
+                ctx.memo[&e] = {epoch, res};
+            ctx.cycle_low = std::min(outer_low, ctx.cycle_low);
+            return res;
+        }
 
         Fact::State operator()(const Empty &)
             {return Fact::State::Undetermined;}
@@ -574,24 +941,27 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
                 throw std::runtime_error("Fact not found in digraph!");
             }
 
+            const Fact::State state = ctx.states.get(it->first);
             if (digraph.isExplain) {
-                digraph.explanation << "IN Var " << v << " "  << it->second.state << std::endl;
+                ctx.explanation << "IN Var " << v << " "  << state << std::endl;
             }
 
-            if (it->second.state == Fact::State::Undetermined) {
-                return digraph.solveForFact(it->second.id);
+            if (state == Fact::State::Undetermined) {
+                return digraph.solveForFact(ctx, it->second.id);
             }
-            return it->second.state;
+            return state;
         }
 
         Fact::State operator()(const Not &n)
         {
             if (digraph.isExplain) {
-                digraph.explanation << "IN Not" << n << std::endl;
+                ctx.explanation << "IN Not" << n << std::endl;
             }
-            return visit(*this, n.child()) == Fact::State::True
+            // the second eval is served from the memo unless the first one
+            // changed the state of the graph
+            return eval(n.child()) == Fact::State::True
                 ? Fact::State::False
-                : visit(*this, n.child()) == Fact::State::False
+                : eval(n.child()) == Fact::State::False
                     ? Fact::State::True
                     : Fact::State::Undetermined;
         }
@@ -599,10 +969,10 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
         Fact::State operator()(const And &n)
         {
             if (digraph.isExplain) {
-                digraph.explanation << "IN And " << n << std::endl;
+                ctx.explanation << "IN And " << n << std::endl;
             }
-            Fact::State lhs = visit(*this, n.lhs());
-            Fact::State rhs = visit(*this, n.rhs());
+            Fact::State lhs = eval(n.lhs());
+            Fact::State rhs = eval(n.rhs());
             if (lhs == Fact::State::False || rhs == Fact::State::False) {
                 return Fact::State::False;
             }
@@ -615,10 +985,10 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
         Fact::State operator()(const Or &n)
         {
             if (digraph.isExplain) {
-                digraph.explanation << "IN Or " << n << std::endl;
+                ctx.explanation << "IN Or " << n << std::endl;
             }
-            Fact::State lhs = visit(*this, n.lhs());
-            Fact::State rhs = visit(*this, n.rhs());
+            Fact::State lhs = eval(n.lhs());
+            Fact::State rhs = eval(n.rhs());
             if (lhs == Fact::State::True || rhs == Fact::State::True) {
                 return Fact::State::True;
             }
@@ -631,10 +1001,10 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
         Fact::State operator()(const Xor &n)
         {
             if (digraph.isExplain) {
-                digraph.explanation << "IN Xor " << n << std::endl;
+                ctx.explanation << "IN Xor " << n << std::endl;
             }
-            Fact::State lhs = visit(*this, n.lhs());
-            Fact::State rhs = visit(*this, n.rhs());
+            Fact::State lhs = eval(n.lhs());
+            Fact::State rhs = eval(n.rhs());
             if (lhs == Fact::State::Undetermined || rhs == Fact::State::Undetermined) {
                 return Fact::State::Undetermined;
             }
@@ -648,23 +1018,23 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
         Fact::State operator()(const Imply &n)
         {
             if (digraph.isExplain) {
-                digraph.explanation << "IN Imply " << n << std::endl;
+                ctx.explanation << "IN Imply " << n << std::endl;
             }
             
-            Expr lhs_real = n.lhs();
-            Expr rhs_real = n.rhs();
-            Fact::State lhs_result = visit(*this, lhs_real);
+            const Expr &lhs_real = n.lhs();
+            const Expr &rhs_real = n.rhs();
+            Fact::State lhs_result = eval(lhs_real);
             
             if (digraph.isExplain) {
-                digraph.explanation << "Imply: LHS (" << lhs_real << ") = " << lhs_result << std::endl;
+                ctx.explanation << "Imply: LHS (" << lhs_real << ") = " << lhs_result << std::endl;
             }
             
             // If antecedent is True, consequent must be True
             if (lhs_result == Fact::State::True) {
                 if (digraph.isExplain) {
-                    digraph.explanation << "Setting " << rhs_real << " to True (antecedent is True)" << std::endl;
+                    ctx.explanation << "Setting " << rhs_real << " to True (antecedent is True)" << std::endl;
                 }
-                digraph.setExprVarsToState(rhs_real, Fact::State::True);
+                digraph.setExprVarsToState(ctx, rhs_real, Fact::State::True);
                 return Fact::State::True;
             }
             
@@ -681,23 +1051,23 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
         Fact::State operator()(const Iff &n)
          {
             if (digraph.isExplain) {
-                digraph.explanation << "In If and only if " << n << std::endl;
+                ctx.explanation << "In If and only if " << n << std::endl;
             }
 
-            Fact::State lhs_state = visit(*this, n.lhs());
-            Fact::State rhs_state = visit(*this, n.rhs());
+            Fact::State lhs_state = eval(n.lhs());
+            Fact::State rhs_state = eval(n.rhs());
 
             if (rhs_state == lhs_state) {
                 if (digraph.isExplain) {
-                    digraph.explanation << "In Iff: both sides aready equal " << n << std::endl;
+                    ctx.explanation << "In Iff: both sides aready equal " << n << std::endl;
                 }
                 if (rhs_state == Fact::State::Undetermined) {
                     return Fact::State::Undetermined;
                 }
             } else if (lhs_state == Fact::State::Undetermined && rhs_state != Fact::State::Undetermined) {
-                digraph.setExprVarsToState(n.lhs(), rhs_state);
+                digraph.setExprVarsToState(ctx, n.lhs(), rhs_state);
             } else if (rhs_state == Fact::State::Undetermined && lhs_state != Fact::State::Undetermined) {
-                digraph.setExprVarsToState(n.rhs(), lhs_state);
+                digraph.setExprVarsToState(ctx, n.rhs(), lhs_state);
             } else {
                 std::stringstream ss;
                 ss << "Contradiction: " << n << " lhs:" << lhs_state << " must equal rhs:" << rhs_state;
@@ -706,10 +1076,224 @@ Fact::State Digraph::solveExpr(const Expr &expr) {
             return Fact::State::True;
         }
     };
-    return std::visit(Solver{*this}, expr);
+    SolveDepthGuard depth(ctx);
+    return Solver{*this, ctx}.eval(expr);
+}
+
+// Condenses the graph into its strongly connected components with Tarjan's
+// algorithm. Tarjan emits a component only once everything it depends on has
+// been emitted, so sccs ends up in dependency order.
+void Digraph::freeze() {
+    dependencies.clear();
+    for (const auto &[id, fact] : facts) {
+        std::set<char> deps;
+        for (const auto &r_id : fact.consequent_rules) {
+            const Rule &rule = rules.at(r_id);
+            deps.insert(rule.antecedent_facts.begin(), rule.antecedent_facts.end());
+            for (char f : rule.consequent_facts) {
+                if (f != id)
+                    deps.insert(f);
+            }
+        }
+        dependencies[id] = std::vector<char>(deps.begin(), deps.end());
+    }
+
+    std::map<char, size_t> index, low;
+    std::vector<char> stack;
+    std::set<char> on_stack;
+    sccs.clear();
+    scc_of.clear();
+
+    std::function<void(const char)> strongConnect = [&](const char v) {
+        index[v] = low[v] = index.size();
+        stack.push_back(v);
+        on_stack.insert(v);
+
+        for (char w : dependencies[v]) {
+            if (!index.contains(w)) {
+                strongConnect(w);
+                low[v] = std::min(low[v], low[w]);
+            } else if (on_stack.contains(w)) {
+                low[v] = std::min(low[v], index[w]);
+            }
+        }
+
+        if (low[v] != index[v])
+            return;
+        Scc scc{{}, false};
+        char w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            on_stack.erase(w);
+            scc.facts.push_back(w);
+            scc_of[w] = sccs.size();
+        } while (w != v);
+        const auto &deps = dependencies[v];
+        scc.isCyclic = scc.facts.size() > 1
+            || std::find(deps.begin(), deps.end(), v) != deps.end();
+        sccs.push_back(scc);
+    };
+
+    std::vector<char> ids;
+    for (const auto &[id, _] : facts)
+        ids.push_back(id);
+    std::sort(ids.begin(), ids.end());
+    for (char id : ids) {
+        if (!index.contains(id))
+            strongConnect(id);
+    }
+    frozen = true;
+}
+
+// Solves the undetermined acyclic components the fact depends on,
+// dependencies first.
+// When a component is reached everything it depends on is settled, so a
+// single solveForFact decides it and it is never searched again. Cyclic
+// components are left to the backward search of solveForFact, which stays
+// local to the component since everything below it is settled. Iterating them
+// to a fixpoint here is not equivalent, the deferred closed world false is
+// order dependent.
+void Digraph::solveInDependencyOrder(SolveContext &ctx, char fact_id) const {
+    auto &settled = ctx.settled;
+    if (!scc_of.contains(fact_id))
+        return;
+
+    std::set<size_t> cone;
+    std::set<char> seen = {fact_id};
+    std::vector<char> pending = {fact_id};
+    while (!pending.empty()) {
+        char f = pending.back();
+        pending.pop_back();
+        // solveExpr never searches below a determined fact
+        if (settled.contains(f) || ctx.states.get(f) != Fact::State::Undetermined)
+            continue;
+        cone.insert(scc_of.at(f));
+        for (char d : dependencies.at(f)) {
+            if (seen.insert(d).second)
+                pending.push_back(d);
+        }
+    }
+
+    // std::set iterates the component indexes in dependency order
+    std::vector<char> tasks;
+    for (size_t i : cone) {
+        if (!sccs[i].isCyclic)
+            tasks.push_back(sccs[i].facts.front());
+    }
+
+    std::vector<std::optional<Presolved>> presolved(tasks.size());
+    if (ctx.pool && ctx.jobs > 1 && tasks.size() > 1)
+        presolved = presolveParallel(ctx, tasks);
+
+    for (size_t t = 0; t < tasks.size(); t++) {
+        const char f = tasks[t];
+        if (ctx.states.get(f) != Fact::State::Undetermined)
+            continue;
+        if (!presolved[t]) {
+            solveForFact(ctx, f);
+            settled.insert(f);
+            continue;
+        }
+        // Replay what solving f on the main context would have left in it
+        SolveContext &local = presolved[t]->ctx;
+        setFactState(ctx, f, local.states.get(f));
+        ctx.useless_rules.insert(local.useless_rules);
+        if (local.defered_set_false.contains(f))
+            ctx.defered_set_false.insert(f);
+        else
+            ctx.defered_set_false.erase(f);
+        ctx.solving_stack = local.solving_stack;
+        ctx.explanation << local.explanation.str();
+        ctx.epoch++;
+        if (presolved[t]->error)
+            std::rethrow_exception(presolved[t]->error);
+        settled.insert(f);
+    }
+}
+
+// Solves, on up to ctx.jobs threads of ctx.pool, the acyclic components of
+// tasks (in dependency order) whose own dependencies are all determined,
+// settled or such tasks.
+// Solving one of them reads only its dependencies and writes only its own
+// fact, so they can run in any order their dependencies allow, each in a
+// scratch context. States are published to the dependent tasks through one
+// atomic word. Components depending on a cyclic one are left as nullopt, the
+// caller solves them on ctx.
+std::vector<std::optional<Digraph::Presolved>> Digraph::presolveParallel(
+        const SolveContext &ctx, const std::vector<char> &tasks) const {
+    std::unordered_map<char, size_t> task_of;
+    for (size_t t = 0; t < tasks.size(); t++)
+        task_of[tasks[t]] = t;
+
+    std::vector<size_t> independent; // task index of each parallel task
+    std::vector<size_t> index_of(tasks.size(), SIZE_MAX);
+    for (size_t t = 0; t < tasks.size(); t++) {
+        bool isIndependent = true;
+        for (char d : dependencies.at(tasks[t])) {
+            auto dt = task_of.find(d);
+            if (dt != task_of.end())
+                isIndependent = isIndependent && index_of[dt->second] != SIZE_MAX;
+            else
+                isIndependent = isIndependent && (ctx.settled.contains(d)
+                    || ctx.states.get(d) != Fact::State::Undetermined);
+        }
+        if (isIndependent) {
+            index_of[t] = independent.size();
+            independent.push_back(t);
+        }
+    }
+
+    std::vector<std::vector<size_t>> dependents(independent.size());
+    std::vector<size_t> pending(independent.size(), 0);
+    for (size_t i = 0; i < independent.size(); i++) {
+        for (char d : dependencies.at(tasks[independent[i]])) {
+            auto dt = task_of.find(d);
+            if (dt != task_of.end()) {
+                dependents[index_of[dt->second]].push_back(i);
+                pending[i]++;
+            }
+        }
+    }
+
+    std::vector<std::optional<Presolved>> res(tasks.size());
+    std::atomic<uint64_t> published{ctx.states.pack()};
+
+    runTaskGraph(*ctx.pool, ctx.jobs, dependents, pending, [&](size_t i) {
+        const char f = tasks[independent[i]];
+        Presolved &out = res[independent[i]].emplace();
+        SolveContext &local = out.ctx;
+        local.states = FactStates::unpack(published.load(std::memory_order_acquire));
+        local.solving_stack = ctx.solving_stack;
+        local.useless_rules = ctx.useless_rules;
+        local.defered_set_false = ctx.defered_set_false;
+        local.settled = ctx.settled;
+        for (char d : dependencies.at(f)) {
+            auto dt = task_of.find(d);
+            if (dt == task_of.end())
+                continue;
+            // done before this task started, see runTaskGraph
+            local.useless_rules.insert(res[dt->second]->ctx.useless_rules);
+            local.settled.insert(d);
+        }
+
+        try {
+            solveForFact(local, f);
+        } catch (...) {
+            out.error = std::current_exception();
+        }
+        FactStates own;
+        own.set(f, local.states.get(f));
+        published.fetch_or(own.pack(), std::memory_order_release);
+    });
+    return res;
 }
 
 Digraph::VarBoolMap Digraph::boolMapEvaluate(const Expr &expr) const {
+    return boolMapEvaluate(context, expr);
+}
+
+Digraph::VarBoolMap Digraph::boolMapEvaluate(const SolveContext &ctx, const Expr &expr) const {
     // const Fact& fact = facts.at(fact_id);
     // const Expr expr = compileExprForFact(fact_id);
     const std::vector<char> all_facts = expr.getAllFacts();
@@ -719,8 +1303,8 @@ Digraph::VarBoolMap Digraph::boolMapEvaluate(const Expr &expr) const {
     std::map<char, bool> knownValues;
 
     for (const auto& f_id : all_facts) {
-        const auto& f = facts.at(f_id);
-        switch (f.state) {
+        (void)facts.at(f_id);
+        switch (ctx.states.get(f_id)) {
             case Fact::State::True:
                 knownValues[f_id] = true;
                 break;
@@ -767,15 +1351,20 @@ Digraph::VarBoolMap Digraph::boolMapEvaluate(const Expr &expr) const {
 
 
 Expr Digraph::compileExprForFact(const char fact_id) {
+    return compileExprForFact(context, fact_id);
+}
+
+Expr Digraph::compileExprForFact(SolveContext &ctx, const char fact_id) const {
     std::vector<std::string> rules_used_ids;
     std::vector<Expr> rules_used;
 
     // Recursive lambda that collects all rules related to a fact
     std::function<void(const char)> ruleCollector = [&](const char f_id) {
         const Fact &fact = facts.at(f_id);
+        const Fact::State state = ctx.states.get(f_id);
 
-        if (fact.state == Fact::State::True || fact.state == Fact::State::False) {
-            Expr new_rule = fact.state == Fact::State::True ? Expr(Var(f_id)) : Expr(Not(Var(f_id)));
+        if (state == Fact::State::True || state == Fact::State::False) {
+            Expr new_rule = state == Fact::State::True ? Expr(Var(f_id)) : Expr(Not(Var(f_id)));
             if (std::find(rules_used_ids.begin(), rules_used_ids.end(), new_rule.toString()) == rules_used_ids.end()) {
                 rules_used_ids.push_back(new_rule.toString());
                 rules_used.push_back(new_rule);
@@ -817,7 +1406,7 @@ Expr Digraph::compileExprForFact(const char fact_id) {
     }
 
     if (isExplain) {
-        explanation << "Compiled logic expression for " << fact_id 
+        ctx.explanation << "Compiled logic expression for " << fact_id 
         << " using " << rules_used.size() << " rules\n";
     }
 
@@ -825,6 +1414,44 @@ Expr Digraph::compileExprForFact(const char fact_id) {
 }
 
 
+SolveContext SolveContext::fork() const {
+    SolveContext res;
+    res.states = states;
+    res.solving_stack = solving_stack;
+    res.compiled_expressions = compiled_expressions;
+    res.useless_rules.added = useless_rules.all();
+    res.defered_set_false = defered_set_false;
+    res.settled = settled;
+    res.epoch = epoch + 1; // memo entries are not copied
+    res.jobs = jobs;
+    res.pool = pool;
+    return res;
+}
+
+SolveContext SolveContext::overlay(const std::shared_ptr<const SolveContext> &base) {
+    SolveContext res;
+    res.states = base->states;
+    res.solving_stack = base->solving_stack;
+    res.compiled_expressions = base->compiled_expressions;
+    // aliases base, which keeps the rule set alive
+    res.useless_rules.base = std::shared_ptr<const RuleSet>(base, &base->useless_rules);
+    res.defered_set_false = base->defered_set_false;
+    res.settled = base->settled;
+    res.epoch = base->epoch + 1;
+    res.jobs = base->jobs;
+    res.pool = base->pool;
+    return res;
+}
+
+
+SolveContext Digraph::newContext() const {
+    SolveContext ctx;
+    for (const auto &[id, fact] : facts)
+        ctx.states.set(id, fact.state);
+    return ctx;
+}
+
+
 Digraph makeDigraph(
         const std::vector<Fact> &facts,
         const std::vector<Rule> &rules,
@@ -844,6 +1471,7 @@ Digraph makeDigraph(
         g.addRule(r);
     }
 
+    g.freeze();
     return g;
 }
 
@@ -12,13 +12,13 @@
 Imply::Imply(const Expr &l, const Expr &r) : _v{l, r} {}
   Iff::Iff  (const Expr &l, const Expr &r) : _v{l, r} {}
 
-char   Var::value() const { return _v; }
-Expr   Not::child() const { return _v[0]; }
-Expr   And::lhs()   const { return _v[0]; } Expr And::rhs()   const { return _v[1]; }
-Expr    Or::lhs()   const { return _v[0]; } Expr Or::rhs()    const { return _v[1]; }
-Expr   Xor::lhs()   const { return _v[0]; } Expr Xor::rhs()   const { return _v[1]; }
-Expr Imply::lhs()   const { return _v[0]; } Expr Imply::rhs() const { return _v[1]; }
-Expr   Iff::lhs()   const { return _v[0]; } Expr Iff::rhs()   const { return _v[1]; }
+char         Var::value() const { return _v; }
+const Expr  &Not::child() const { return _v[0]; }
+const Expr  &And::lhs()   const { return _v[0]; } const Expr &And::rhs()   const { return _v[1]; }
+const Expr   &Or::lhs()   const { return _v[0]; } const Expr &Or::rhs()    const { return _v[1]; }
+const Expr  &Xor::lhs()   const { return _v[0]; } const Expr &Xor::rhs()   const { return _v[1]; }
+const Expr &Imply::lhs()  const { return _v[0]; } const Expr &Imply::rhs() const { return _v[1]; }
+const Expr  &Iff::lhs()   const { return _v[0]; } const Expr &Iff::rhs()   const { return _v[1]; }
 
 # include <iostream>
 
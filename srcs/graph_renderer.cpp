@@ -0,0 +1,97 @@
+#include <iostream>
+
+#include "graph_renderer.hpp"
+
+
+GraphRenderer::GraphRenderer(size_t capacity, const std::string &format, Render render)
+    : _format(format), _render(std::move(render)), _images(capacity) {}
+
+
+std::string GraphRenderer::keyOf(const std::string &dot, const std::string &format) {
+    return ResultCache::hex(ResultCache::sha256(format + '\0' + dot));
+}
+
+
+std::string GraphRenderer::queue(const std::string &dot) {
+    const std::string key = this->key(dot);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_images.contains(key) || !_pending.emplace(key, dot).second)
+            return key;
+    }
+    _thread.submit([this, key, dot] {
+        _images.getOrCompute(key, [&] { return render(dot); });
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.erase(key);
+    });
+    return key;
+}
+
+
+// Waits for the render when it is under way
+std::shared_ptr<const RenderedGraph> GraphRenderer::image(const std::string &key) {
+    std::string dot;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto pending = _pending.find(key);
+        if (pending != _pending.end())
+            dot = pending->second;
+    }
+    if (dot.empty()) {
+        // rendered since, or unknown
+        return _images.get(key);
+    }
+    return _images.getOrCompute(key, [&] { return render(dot); });
+}
+
+
+void GraphRenderer::wait() {
+    _thread.submit([] {}).wait();
+}
+
+
+std::shared_ptr<const RenderedGraph> GraphRenderer::render(const std::string &dot) const {
+    auto res = std::make_shared<RenderedGraph>();
+    res->image = _render(dot, _format);
+    return res;
+}
+
+
+#ifdef WITH_GRAPHVIZ
+#include <graphviz/gvc.h>
+
+std::string GraphRenderer::graphviz(const std::string &dot, const std::string &format) {
+    // graphviz keeps global state, graphs are rendered one at a time on the
+    // context of the process, made once
+    static std::mutex gvMutex;
+    std::lock_guard<std::mutex> lock(gvMutex);
+    static GVC_t *gvc = gvContext();
+
+    Agraph_t *g = agmemread(dot.c_str());
+    if (!g) {
+        std::cerr << "Error: could not parse graph spec.\n";
+        return "";
+    }
+
+    char *data = nullptr;
+    size_t size = 0;
+    gvLayout(gvc, g, "dot");
+    gvRenderData(gvc, g, format.c_str(), &data, &size);
+    std::string res = data ? std::string(data, size) : "";
+    gvFreeRenderData(data);
+    gvFreeLayout(gvc, g);
+    agclose(g);
+    if (format != "png" && res.find("<svg") != std::string::npos)
+        res.erase(0, res.find("<svg"));
+    return res;
+}
+
+#else
+
+std::string GraphRenderer::graphviz(const std::string &dot, const std::string &format) {
+    (void)dot;
+    (void)format;
+    return "";
+}
+
+#endif
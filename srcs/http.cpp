@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cctype>
+
+#include "http.hpp"
+
+
+static bool equalsIgnoreCase(const std::string &a, const std::string &b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+        [](char x, char y) { return std::tolower(x) == std::tolower(y); });
+}
+
+static std::string toLower(std::string s) {
+    for (char &c : s)
+        c = std::tolower(c);
+    return s;
+}
+
+
+/* ** HttpRequest ** */
+
+std::string HttpRequest::header(const std::string &name) const {
+    for (const auto &[key, value] : headers) {
+        if (equalsIgnoreCase(key, name))
+            return value;
+    }
+    return "";
+}
+
+std::string HttpRequest::path() const {
+    return target.substr(0, target.find('?'));
+}
+
+std::string HttpRequest::query() const {
+    size_t start = target.find('?');
+    return start == std::string::npos ? "" : target.substr(start + 1);
+}
+
+bool HttpRequest::isKeepAlive() const {
+    std::string connection = toLower(header("Connection"));
+    if (connection.find("close") != std::string::npos)
+        return false;
+    if (connection.find("keep-alive") != std::string::npos)
+        return true;
+    return version == "HTTP/1.1";
+}
+
+
+/* ** HttpResponse ** */
+
+void HttpResponse::append(std::string part) {
+    if (part.empty())
+        return;
+    owned.push_back(std::move(part));
+    parts.push_back(owned.back());
+}
+
+void HttpResponse::appendStatic(std::string_view part) {
+    if (!part.empty())
+        parts.push_back(part);
+}
+
+void HttpResponse::appendShared(std::shared_ptr<const std::string> part) {
+    if (!part || part->empty())
+        return;
+    parts.push_back(*part);
+    shared.push_back(std::move(part));
+}
+
+void HttpResponse::append(HttpResponse &&other) {
+    owned.splice(owned.end(), other.owned);
+    shared.insert(shared.end(), other.shared.begin(), other.shared.end());
+    other.shared.clear();
+    parts.insert(parts.end(), other.parts.begin(), other.parts.end());
+    other.parts.clear();
+}
+
+size_t HttpResponse::bodySize() const {
+    size_t size = 0;
+    for (const auto &part : parts)
+        size += part.size();
+    return size;
+}
+
+void HttpResponse::finish(bool keepAlive, bool isHead) {
+    head += "Content-Length: " + std::to_string(bodySize()) + "\r\n";
+    head += keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    head += "\r\n";
+    if (isHead) {
+        parts.clear();
+        owned.clear();
+        shared.clear();
+    }
+}
+
+int HttpResponse::iovecs(size_t sent, iovec *iov, int max) const {
+    int count = 0;
+    auto add = [&](std::string_view part) {
+        if (sent >= part.size()) {
+            sent -= part.size();
+            return;
+        }
+        iov[count].iov_base = const_cast<char *>(part.data() + sent);
+        iov[count].iov_len = part.size() - sent;
+        sent = 0;
+        count++;
+    };
+    add(head);
+    for (size_t i = 0; i < parts.size() && count < max; i++)
+        add(parts[i]);
+    return count;
+}
+
+std::string HttpResponse::str() const {
+    std::string res = head;
+    for (const auto &part : parts)
+        res += part;
+    return res;
+}
+
+
+/* ** HttpParser ** */
+
+HttpParser::HttpParser(size_t maxBody) : maxBody(maxBody) {}
+
+
+void HttpParser::feed(const char *data, size_t size) {
+    if (state == State::Error)
+        return;
+    // what is parsed is dropped once it is worth the move
+    if (pos == buffer.size()) {
+        buffer.clear();
+        scanned = pos = 0;
+    } else if (pos > (1 << 16)) {
+        buffer.erase(0, pos);
+        scanned -= pos;
+        pos = 0;
+    }
+    buffer.append(data, size);
+    parse();
+}
+
+
+HttpRequest HttpParser::take() {
+    HttpRequest res = std::move(current);
+    current = HttpRequest{};
+    headerBytes = 0;
+    isContinue = false;
+    state = State::RequestLine;
+    parse();
+    return res;
+}
+
+
+bool HttpParser::takeContinue() {
+    bool res = isContinue;
+    isContinue = false;
+    return res;
+}
+
+
+// The next line without its "\r\n" (or lone "\n"), false until there is one
+bool HttpParser::nextLine(std::string &line) {
+    size_t end = buffer.find('\n', std::max(scanned, pos));
+    if (end == std::string::npos) {
+        scanned = buffer.size();
+        if (headerBytes + buffer.size() - pos > MAX_HEADERS)
+            fail(431, "Request headers too large");
+        return false;
+    }
+    size_t size = end - pos;
+    if (size > 0 && buffer[end - 1] == '\r')
+        size--;
+    line.assign(buffer, pos, size);
+    headerBytes += end + 1 - pos;
+    pos = end + 1;
+    scanned = pos;
+    if (headerBytes > MAX_HEADERS)
+        fail(431, "Request headers too large");
+    return true;
+}
+
+
+void HttpParser::parse() {
+    std::string line;
+    while (state != State::Done && state != State::Error) {
+        switch (state) {
+            case State::RequestLine:
+            case State::Headers:
+            case State::ChunkSize:
+            case State::ChunkEnd:
+            case State::Trailers:
+                if (!nextLine(line))
+                    return;
+                if (state == State::Error)
+                    return;
+                if (state == State::RequestLine)
+                    requestLine(line);
+                else if (state == State::Headers)
+                    headerLine(line);
+                else if (state == State::ChunkSize)
+                    chunkSize(line);
+                else if (state == State::ChunkEnd) {
+                    if (!line.empty())
+                        fail(400, "Chunk longer than its size");
+                    else
+                        state = State::ChunkSize;
+                } else if (line.empty())
+                    state = State::Done; // trailers are ignored
+                break;
+            case State::Body:
+            case State::ChunkData: {
+                size_t size = std::min(remaining, buffer.size() - pos);
+                if (size == 0)
+                    return;
+                current.body.append(buffer, pos, size);
+                pos += size;
+                scanned = pos;
+                remaining -= size;
+                if (remaining == 0)
+                    state = state == State::Body ? State::Done : State::ChunkEnd;
+                break;
+            }
+            default:
+                return;
+        }
+    }
+}
+
+
+void HttpParser::requestLine(const std::string &line) {
+    if (line.empty())
+        return; // a stray CRLF between requests
+    size_t first = line.find(' ');
+    size_t last = line.rfind(' ');
+    if (first == std::string::npos || first == last || first == 0)
+        return fail(400, "Bad request line");
+    current.method = line.substr(0, first);
+    current.target = line.substr(first + 1, last - first - 1);
+    current.version = line.substr(last + 1);
+    if (current.target.empty() || current.target.find(' ') != std::string::npos)
+        return fail(400, "Bad request line");
+    if (current.version != "HTTP/1.1" && current.version != "HTTP/1.0")
+        return fail(505, "HTTP version not supported");
+    state = State::Headers;
+}
+
+
+void HttpParser::headerLine(const std::string &line) {
+    if (line.empty())
+        return headersDone();
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0 || line[0] == ' ' || line[0] == '\t'
+            || line.find_first_of(" \t") < colon)
+        return fail(400, "Bad header line");
+    size_t from = line.find_first_not_of(" \t", colon + 1);
+    size_t to = line.find_last_not_of(" \t");
+    current.headers.emplace_back(line.substr(0, colon),
+        from == std::string::npos ? "" : line.substr(from, to - from + 1));
+}
+
+
+void HttpParser::headersDone() {
+    const std::string encoding = toLower(current.header("Transfer-Encoding"));
+    const std::string length = current.header("Content-Length");
+    const size_t lengths = std::count_if(current.headers.begin(), current.headers.end(),
+        [](const auto &h) { return equalsIgnoreCase(h.first, "Content-Length"); });
+
+    if (!encoding.empty()) {
+        // both would let a proxy and this server disagree on the body
+        if (lengths)
+            return fail(400, "Both Content-Length and Transfer-Encoding");
+        if (encoding != "chunked")
+            return fail(501, "Unsupported transfer encoding: " + encoding);
+        state = State::ChunkSize;
+    } else if (lengths) {
+        if (lengths > 1 || length.empty() || length.find_first_not_of("0123456789") != std::string::npos)
+            return fail(400, "Bad Content-Length");
+        if (length.size() > 18 || std::stoull(length) > maxBody)
+            return fail(413, "Request body too large");
+        remaining = std::stoull(length);
+        state = remaining ? State::Body : State::Done;
+    } else {
+        state = State::Done;
+    }
+    isContinue = state != State::Done && equalsIgnoreCase(current.header("Expect"), "100-continue");
+}
+
+
+void HttpParser::chunkSize(const std::string &line) {
+    size_t end = line.find_first_of("; \t");
+    std::string hex = line.substr(0, end);
+    if (hex.empty() || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        return fail(400, "Bad chunk size");
+    if (hex.size() > 15)
+        return fail(413, "Request body too large");
+    remaining = std::stoull(hex, nullptr, 16);
+    if (current.body.size() + remaining > maxBody)
+        return fail(413, "Request body too large");
+    state = remaining ? State::ChunkData : State::Trailers;
+}
+
+
+void HttpParser::fail(int status, const std::string &message) {
+    state = State::Error;
+    _errorStatus = status;
+    _errorMessage = message;
+}
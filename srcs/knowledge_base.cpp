@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <fstream>
+
+#include "knowledge_base.hpp"
+#include "parser.hpp"
+
+
+KnowledgeBase::KnowledgeBase(const std::vector<Rule> &rules) {
+    // every fact is in the graph, so any of them can be given or asked for
+    std::vector<Query> all_facts;
+    for (char c = 'A'; c <= 'Z'; c++)
+        all_facts.push_back(Query(c));
+    _graph = std::make_shared<const Digraph>(makeDigraph({}, rules, all_facts));
+
+    std::vector<Expr> exprs;
+    for (const auto &r : rules)
+        exprs.push_back(r.expr);
+    _rules = std::make_shared<const std::vector<Expr>>(std::move(exprs));
+}
+
+
+static std::vector<Rule> toRules(const std::vector<Expr> &exprs) {
+    std::vector<Rule> rules;
+    for (const auto &e : exprs)
+        rules.push_back(Rule(e));
+    return rules;
+}
+
+KnowledgeBase::KnowledgeBase(const std::vector<Expr> &rules) : KnowledgeBase(toRules(rules)) {}
+
+
+KnowledgeBase KnowledgeBase::fromText(const std::string &rules) {
+    std::vector<Token> tokens = tokenizer(rules);
+    for (const auto &t : tokens) {
+        if (t.type == Token::Type::Fact || t.type == Token::Type::Query)
+            throw std::runtime_error("Unexpected '" + t.token_list
+                + "' in rules, line: " + std::to_string(t.line_number));
+    }
+    auto [parsed, _, __] = parseTokens(tokens, false);
+    return KnowledgeBase(parsed);
+}
+
+
+uint32_t KnowledgeBase::factMask(const std::vector<Fact> &facts) {
+    uint32_t mask = 0;
+    for (const auto &f : facts) {
+        if (f.state == Fact::State::True)
+            mask |= 1u << (f.label - 'A');
+    }
+    return mask;
+}
+
+
+uint32_t KnowledgeBase::factMask(const std::string &facts) {
+    uint32_t mask = 0;
+    for (char c : facts) {
+        if (c < 'A' || c > 'Z')
+            throw std::invalid_argument("Invalid fact: " + std::string(1, c));
+        mask |= 1u << (c - 'A');
+    }
+    return mask;
+}
+
+
+std::vector<Query> KnowledgeBase::queryList(const std::string &queries) {
+    std::vector<Query> res;
+    for (char c : queries) {
+        if (c < 'A' || c > 'Z')
+            throw std::invalid_argument("Invalid query: " + std::string(1, c));
+        res.push_back(Query(c));
+    }
+    return res;
+}
+
+
+KnowledgeBase::Result KnowledgeBase::evaluate(const std::string &facts, const std::string &queries) const {
+    return evaluate(factMask(facts), queryList(queries));
+}
+
+
+KnowledgeBase::Result KnowledgeBase::evaluate(uint32_t facts, const std::vector<Query> &queries) const {
+    return _graph->solveScenario(facts, queries,
+        [this](SolveContext &ctx, char fact_id) { return compiled(ctx, fact_id); });
+}
+
+
+// compileExprForFact only reads the states of the facts in the cone of the
+// query, they are the key with the query
+std::shared_ptr<const Expr> KnowledgeBase::compiled(SolveContext &ctx, char fact_id) const {
+    const uint32_t cone = _graph->dependencyCone(fact_id);
+    const uint64_t key = uint64_t(fact_id - 'A') << 52
+        | uint64_t(ctx.states.known & cone) << 26 | (ctx.states.truth & cone);
+    {
+        std::lock_guard<std::mutex> lock(_compiled->mutex);
+        auto it = _compiled->exprs.find(key);
+        if (it != _compiled->exprs.end())
+            return it->second;
+    }
+    auto expr = std::make_shared<const Expr>(_graph->compileExprForFact(ctx, fact_id));
+    std::lock_guard<std::mutex> lock(_compiled->mutex);
+    if (_compiled->exprs.size() >= Compiled::MAX_EXPRS)
+        _compiled->exprs.clear();
+    return _compiled->exprs.emplace(key, std::move(expr)).first->second;
+}
+
+
+size_t KnowledgeBase::compiledCount() const {
+    std::lock_guard<std::mutex> lock(_compiled->mutex);
+    return _compiled->exprs.size();
+}
+
+
+namespace {
+
+// Nodes of an expression tree
+struct NodeCounter {
+    size_t operator()(const Empty &) const { return 1; }
+    size_t operator()(const Var &) const { return 1; }
+    size_t operator()(const Not &n) const { return 1 + std::visit(*this, n.child()); }
+    template <typename Binary>
+    size_t operator()(const Binary &n) const {
+        return 1 + std::visit(*this, n.lhs()) + std::visit(*this, n.rhs());
+    }
+};
+
+} // namespace
+
+// A compiled expression is counted as large as the rules of its fact's cone,
+// and a fact has at most 3^|cone| of them, one per states of the cone. The
+// largest ones fill the MAX_EXPRS the cache keeps.
+size_t KnowledgeBase::memoryEstimate() const {
+    const Digraph &graph = *_graph;
+    size_t bytes = sizeof(Digraph) + graph.facts.size() * sizeof(Fact);
+    size_t nodes = 0;
+    std::map<char, size_t> concludingNodes;
+    for (const auto &[id, rule] : graph.rules) {
+        // the id is both the key and a member
+        bytes += sizeof(Rule) + 2 * id.size() + rule.comment.size()
+            + rule.antecedent_facts.size() + rule.consequent_facts.size();
+        const size_t n = std::visit(NodeCounter{}, rule.expr);
+        nodes += n;
+        for (char f : rule.consequent_facts)
+            concludingNodes[f] += n;
+    }
+    // in the graph and in _rules
+    bytes += 2 * nodes * sizeof(Expr);
+
+    std::vector<std::pair<size_t, size_t>> compiled; // bytes, count
+    for (const auto &[id, _] : graph.facts) {
+        const uint32_t cone = graph.dependencyCone(id) | (1u << (id - 'A'));
+        size_t coneNodes = 1, count = 1;
+        for (int b = 0; b < 26; b++) {
+            if (!(cone & (1u << b)))
+                continue;
+            coneNodes += concludingNodes['A' + b];
+            count = std::min(count * 3, Compiled::MAX_EXPRS);
+        }
+        // plus the map entry, its key and the shared_ptr control block
+        compiled.push_back({coneNodes * sizeof(Expr) + 64, count});
+    }
+    std::sort(compiled.rbegin(), compiled.rend());
+    size_t kept = 0;
+    for (const auto &[size, count] : compiled) {
+        const size_t n = std::min(count, Compiled::MAX_EXPRS - kept);
+        bytes += n * size;
+        kept += n;
+    }
+    return bytes;
+}
+
+
+std::vector<KnowledgeBase::Result> KnowledgeBase::evaluateBatch(
+        const std::vector<uint32_t> &facts, const std::vector<Query> &queries) const {
+    std::vector<std::vector<Fact>> scenarios;
+    scenarios.reserve(facts.size());
+    for (uint32_t mask : facts) {
+        std::vector<Fact> scenario;
+        for (int b = 0; b < 26; b++) {
+            if (mask & (1u << b))
+                scenario.push_back(Fact('A' + b, Fact::State::True));
+        }
+        scenarios.push_back(std::move(scenario));
+    }
+    return _graph->solveScenarios(scenarios, queries);
+}
+
+
+RuleFile parseRuleFile(const std::string &name, const std::string &text) {
+    auto [rules, facts, queries] = parseTokens(tokenizer(text), false);
+    return {name, KnowledgeBase(rules), KnowledgeBase::factMask(facts), queries};
+}
+
+std::string getFileInput(const char *fileName) {
+    std::ifstream file(fileName);
+    if (!file)
+        throw std::runtime_error("Cannot open file \"" + std::string(fileName) + "\"");
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+
+RuleFile loadRuleFile(const std::string &path) {
+    return parseRuleFile(path, getFileInput(path.c_str()));
+}
+
+
+/*
+** Compiled layout
+** ----------------------------
+** "ESKB", a version byte, the rule count as a little endian uint32, then
+** each rule in prefix order: one opcode byte per node, a Var is followed by
+** its letter.
+*/
+namespace {
+
+enum Op : uint8_t { OpVar = 1, OpNot, OpAnd, OpOr, OpXor, OpImply, OpIff };
+
+const char kMagic[4] = {'E', 'S', 'K', 'B'};
+const uint8_t kVersion = 1;
+const size_t kMaxDepth = 4096;
+
+struct Encoder {
+    std::vector<uint8_t> &out;
+
+    void binary(Op op, const Expr &l, const Expr &r) {
+        out.push_back(op);
+        visit(*this, l);
+        visit(*this, r);
+    }
+    void operator()(const Var &v)   { out.push_back(OpVar); out.push_back(v.value()); }
+    void operator()(const Not &n)   { out.push_back(OpNot); visit(*this, n.child()); }
+    void operator()(const And &n)   { binary(OpAnd, n.lhs(), n.rhs()); }
+    void operator()(const Or &n)    { binary(OpOr, n.lhs(), n.rhs()); }
+    void operator()(const Xor &n)   { binary(OpXor, n.lhs(), n.rhs()); }
+    void operator()(const Imply &n) { binary(OpImply, n.lhs(), n.rhs()); }
+    void operator()(const Iff &n)   { binary(OpIff, n.lhs(), n.rhs()); }
+    void operator()(const Empty &)  { throw std::runtime_error("Empty expression in rule"); }
+};
+
+struct Decoder {
+    const uint8_t *bytes;
+    size_t size;
+    size_t pos = 0;
+
+    uint8_t next() {
+        if (pos >= size)
+            throw std::runtime_error("Compiled rules: unexpected end of data");
+        return bytes[pos++];
+    }
+
+    Expr expr(size_t depth) {
+        if (depth > kMaxDepth)
+            throw std::runtime_error("Compiled rules: expression too deep");
+        const uint8_t op = next();
+        switch (op) {
+            case OpVar: {
+                const char c = next();
+                if (c < 'A' || c > 'Z')
+                    throw std::runtime_error("Compiled rules: invalid fact");
+                return Var(c);
+            }
+            case OpNot: return Not(expr(depth + 1));
+            default: break;
+        }
+        if (op < OpAnd || op > OpIff)
+            throw std::runtime_error("Compiled rules: invalid opcode " + std::to_string(op));
+        Expr l = expr(depth + 1);
+        Expr r = expr(depth + 1);
+        switch (op) {
+            case OpAnd:   return And(l, r);
+            case OpOr:    return Or(l, r);
+            case OpXor:   return Xor(l, r);
+            case OpImply: return Imply(l, r);
+            default:      return Iff(l, r);
+        }
+    }
+};
+
+} // namespace
+
+
+std::vector<uint8_t> KnowledgeBase::serialize() const {
+    std::vector<uint8_t> out(kMagic, kMagic + 4);
+    out.push_back(kVersion);
+    const uint32_t count = _rules->size();
+    for (int i = 0; i < 4; i++)
+        out.push_back(count >> (8 * i));
+    for (const auto &e : *_rules)
+        visit(Encoder{out}, e);
+    return out;
+}
+
+
+KnowledgeBase KnowledgeBase::fromBytes(const uint8_t *bytes, size_t size) {
+    if (size < 9 || !std::equal(kMagic, kMagic + 4, bytes))
+        throw std::runtime_error("Compiled rules: bad header");
+    if (bytes[4] != kVersion)
+        throw std::runtime_error("Compiled rules: unsupported version " + std::to_string(bytes[4]));
+    uint32_t count = 0;
+    for (int i = 0; i < 4; i++)
+        count |= uint32_t(bytes[5 + i]) << (8 * i);
+
+    Decoder decoder{bytes, size, 9};
+    std::vector<Expr> rules;
+    for (uint32_t i = 0; i < count; i++) {
+        Expr e = decoder.expr(0);
+        if (!std::holds_alternative<Imply>(e) && !std::holds_alternative<Iff>(e))
+            throw std::runtime_error("Compiled rules: rule " + std::to_string(i) + " is not an implication");
+        rules.push_back(e);
+    }
+    if (decoder.pos != size)
+        throw std::runtime_error("Compiled rules: trailing data");
+    return KnowledgeBase(rules);
+}
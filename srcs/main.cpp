@@ -1,18 +1,30 @@
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <algorithm>
+#include <map>
 
 #include "expert-system.hpp"
 #include "parser.hpp"
 #include "server.hpp"
+#include "daemon.hpp"
+#include "stream.hpp"
+#include "batch.hpp"
 
 
 InputOptions parseInput(int ac, char **av);
 std::string getInputOrErrorExit(const InputOptions &opts);
-std::string getNewFactsLineFromUser(std::string input);
+std::string getNewFactsLineFromUser();
+std::string replaceFactsLine(const std::string &input, const std::string &newFactsLine, bool &replaced);
+std::optional<std::vector<Fact>> parseFactsLine(const std::string &line);
+void whatIfFromUser(const Digraph &digraph, const Digraph::Snapshot &snap, const std::vector<Query> &queries);
 bool isHelpPrint(const InputOptions &opts, char *argv0);
 bool isServerLaunch(const InputOptions &opts);
+bool isDaemonLaunch(const InputOptions &opts);
+bool isStreamLaunch(const InputOptions &opts, int &ret);
+bool isBatchLaunch(const InputOptions &opts, int &ret);
+int solveScenarios(const std::string &input);
 
 
 int main(int argc, char ** argv) {
@@ -24,22 +36,47 @@ int main(int argc, char ** argv) {
     if (isServerLaunch(opts))
         return 0;
 
+    if (isDaemonLaunch(opts))
+        return 0;
+
+    int ret = 0;
+    if (isStreamLaunch(opts, ret))
+        return ret;
+
+    if (isBatchLaunch(opts, ret))
+        return ret;
+
     std::string input = getInputOrErrorExit(opts);
 
+    if (opts.isScenarios)
+        return solveScenarios(input);
+
     // MAIN ENTRY POINT
+    // In interactive mode the graph is kept between evaluations as long as
+    // only the facts line changes, its solved state is then updated in place
+    Digraph digraph;
+    std::vector<Query> queries;
+    bool isReused = false;
     while (true) {
-        Digraph digraph;
         try {
-            std::vector<Token> tokens = tokenizer(input);
-            auto [rules, facts, queries] = parseTokens(tokens);
-            digraph = makeDigraph(facts, rules, queries);
-            digraph.isExplain = opts.isExplain;
-            digraph.applyWorldAssumption(opts.isOpenWorldAssumption);
+            if (!isReused) {
+                std::vector<Token> tokens = tokenizer(input);
+                auto [rules, facts, parsed_queries] = opts.isLazy
+                    ? parseTokensQueryCone(tokens) : parseTokens(tokens);
+                digraph = makeDigraph(facts, rules, parsed_queries);
+                digraph.isExplain = opts.isExplain;
+                digraph.applyWorldAssumption(opts.isOpenWorldAssumption);
+                queries.clear();
+                for (const auto &q : parsed_queries)
+                    queries.push_back(q);
+            }
 
-            auto [conclusion, explanation, isError] = digraph.solveEverythingNoThrow(queries);
+            auto [conclusion, explanation, isError] = opts.jobs > 1 && !opts.isDot
+                ? digraph.solveQueriesParallel(queries, opts.jobs)
+                : digraph.solveEverythingNoThrow(queries);
 
             if (opts.isDot) {
-                std::cout << digraph.toDot();
+                digraph.writeDot(std::cout, queryCone(queries, opts.dotDepth, opts.dotFanIn));
                 break;
             } else if(opts.isExplain) {
                 std::cout << "CONCLUSION\n"  << conclusion << "\n"
@@ -56,13 +93,29 @@ int main(int argc, char ** argv) {
             return 1;
         }
         if (opts.isInteractive) {
-            std::cout << "Do you want to change the facts and re-evaluate? (y/n): ";
             std::string answer;
-            std::getline(std::cin, answer);
+            // taken at the first what-if, the next ones ask the same
+            std::optional<Digraph::Snapshot> snap;
+            while (true) {
+                std::cout << "Do you want to change the facts and re-evaluate? (y/n, w for what-if): ";
+                std::getline(std::cin, answer);
+                if (answer != "w" && answer != "W")
+                    break;
+                if (!snap)
+                    snap = digraph.snapshot();
+                whatIfFromUser(digraph, *snap, queries);
+            }
             if (answer != "y" && answer != "Y") {
                 break;
             } else {
-                input = getNewFactsLineFromUser(input);
+                std::string factsLine = getNewFactsLineFromUser();
+                bool replaced = false;
+                input = replaceFactsLine(input, factsLine, replaced);
+                // the explanation reports every step from the start
+                auto facts = parseFactsLine(factsLine);
+                isReused = replaced && facts && !opts.isExplain;
+                if (isReused)
+                    digraph.updateFacts(*facts, queries, opts.isOpenWorldAssumption);
             }
         } else {
             break;
@@ -87,50 +140,115 @@ InputOptions parseInput(int ac, char **av) {
             res.isDot = true;
         else if (s == "--interactive" || s == "-i")
             res.isInteractive = true;
+        else if (s == "--lazy" || s == "-l")
+            res.isLazy = true;
+        else if (s == "--scenarios")
+            res.isScenarios = true;
+        else if (s == "--stream")
+            res.isStream = true;
         else if (s == "--bonus" || s == "-b")
             res.isCustom = true;
         // else if (s == "--openWorldAssumption")
         //     res.isOpenWorldAssumption = true;
         else if (s.starts_with("--port="))
             res.port = std::stoi(s.substr(7));
-        else
+        else if (s.starts_with("--backlog="))
+            res.backlog = std::stoi(s.substr(10));
+        else if (s.starts_with("--threads="))
+            res.threads = std::stoul(s.substr(10));
+        else if (s.starts_with("--workers="))
+            res.workers = std::stoul(s.substr(10));
+        else if (s.starts_with("--request-timeout="))
+            res.requestTimeout = std::stoi(s.substr(18));
+        else if (s.starts_with("--keep-alive="))
+            res.keepAlive = std::stoi(s.substr(13));
+        else if (s.starts_with("--max-body="))
+            res.maxBody = std::stoul(s.substr(11));
+        else if (s.starts_with("--session-memory="))
+            res.sessionMemory = std::stoul(s.substr(17));
+        else if (s.starts_with("--cache-memory="))
+            res.cacheMemory = std::stoul(s.substr(15));
+        else if (s.starts_with("--dot-depth="))
+            res.dotDepth = std::stoul(s.substr(12));
+        else if (s.starts_with("--dot-fan-in="))
+            res.dotFanIn = std::stoul(s.substr(13));
+        else if (s.starts_with("--graph="))
+            res.graphFormat = s.substr(8) == "png" ? "png" : "svg";
+        else if (s.starts_with("--daemon="))
+            res.daemonSocket = s.substr(9);
+        else if (s.starts_with("--batch="))
+            res.batch = s.substr(8);
+        else if (s.starts_with("--jobs=")) {
+            int jobs = std::stoi(s.substr(7));
+            res.jobs = jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+        }
+        else {
             res.file = av[i];
+            res.files.push_back(av[i]);
+        }
     }
     return res;
 }
 
 
-std::string getNewFactsLineFromUser(std::string input) {
+std::string getNewFactsLineFromUser() {
     std::cout << "Enter new facts line (e.g., '=AB'): ";
     std::string newFactsLine;
     std::getline(std::cin, newFactsLine);
-    // Replace the facts line in the input
+    return newFactsLine;
+}
+
+
+std::string replaceFactsLine(const std::string &input, const std::string &newFactsLine, bool &replaced) {
     std::istringstream iss(input);
     std::string line;
     std::string updatedInput;
-    bool foundFactsLine = false;
+    replaced = false;
     while (std::getline(iss, line)) {
         if (!line.empty() && line[0] == '=') {
             updatedInput += newFactsLine + "\n";
-            foundFactsLine = true;
+            replaced = true;
         } else {
             updatedInput += line + "\n";
         }
     }
-    if (!foundFactsLine) {
+    if (!replaced) {
         updatedInput += newFactsLine + "\n";
     }
     return updatedInput;
 }
 
 
-std::string getFileInput(char *fileName) {
-    std::ifstream file(fileName);
-    if (!file) throw std::runtime_error("Cannot open file \"" 
-            + std::string(fileName) + "\"");
-    std::ostringstream ss;
-    ss << file.rdbuf();
-    return ss.str();
+// The facts of a line holding nothing but "=...", nullopt for anything else,
+// the whole input is parsed again then
+std::optional<std::vector<Fact>> parseFactsLine(const std::string &line) {
+    if (line.empty() || line[0] != '=')
+        return std::nullopt;
+    try {
+        std::vector<Token> tokens = tokenizer(line);
+        size_t count = std::count_if(tokens.begin(), tokens.end(),
+            [](const Token &t) { return t.token_list == "=" || t.type == Token::Type::Query; });
+        if (count != 1)
+            return std::nullopt;
+        return parseFacts(tokens);
+    } catch (std::exception &) {
+        return std::nullopt;
+    }
+}
+
+
+// Answers the queries as if the facts of the line were given, "A !C" is A
+// True and C False, against snap and without changing the graph
+void whatIfFromUser(const Digraph &digraph, const Digraph::Snapshot &snap, const std::vector<Query> &queries) {
+    std::cout << "What if (e.g., 'A !C'): ";
+    std::string line;
+    std::getline(std::cin, line);
+    try {
+        auto [set_true, set_false] = parseWhatIf(line);
+        std::cout << digraph.whatIf(snap, set_true, set_false, queries).result().conlusion;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+    }
 }
 
 
@@ -173,9 +291,27 @@ bool isHelpPrint(const InputOptions &opts , char *argv0) {
     << std::endl << "  -h, --help                 Show this help message and exit"
     << std::endl << "  -s, --server               Launch a webserver for an interactive interface"
     << std::endl << "      --port=NUMBER          Specify port for server mode (default: 7711)"
+    << std::endl << "      --backlog=NUMBER       Pending connections the server queues (default: 128)"
+    << std::endl << "      --threads=NUMBER       Server threads answering requests (0: one per core)"
+    << std::endl << "      --workers=NUMBER       Server processes sharing the port, restarted if they die,"
+    << std::endl << "                             without sessions and with graphs inside the pages"
+    << std::endl << "      --request-timeout=SEC  With --workers, restart a worker stuck on a request (default: 30)"
+    << std::endl << "      --keep-alive=SEC       Close server and daemon connections idle for SEC seconds (default: 5)"
+    << std::endl << "      --max-body=MB          Largest request body the server reads (default: 256)"
+    << std::endl << "      --session-memory=MB    Compiled rule sets the server keeps (default: 64)"
+    << std::endl << "      --cache-memory=MB      Results and graphs the server keeps (default: 64 each)"
+    << std::endl << "      --graph=FORMAT         Server graphs as svg (default) or png"
+    << std::endl << "      --daemon=PATH          Serve the given rule files on a Unix socket"
     << std::endl << "  -e, --explain              Print explanation of the reasoning process"
-    << std::endl << "  -d, --dot                  Output reasoning as a Graphviz DOT file"
+    << std::endl << "  -d, --dot                  Output the rules the queries depend on as a Graphviz DOT file"
+    << std::endl << "      --dot-depth=NUMBER     Levels of rules below the queries in graphs (0: all)"
+    << std::endl << "      --dot-fan-in=NUMBER    One node for a fact concluded by more rules (0: never)"
     << std::endl << "  -i, --interactive          Enable interactive mode (modify facts after evaluation)"
+    << std::endl << "  -l, --lazy                 Only load the rules the queries depend on"
+    << std::endl << "      --scenarios            Rules once, then any number of '=' and '?' lines"
+    << std::endl << "      --stream               Answer JSON lines from stdin against the rule file"
+    << std::endl << "      --batch=DIR|LIST       Solve every file of a directory or list, in one process"
+    << std::endl << "      --jobs=NUMBER          Solve the queries on NUMBER threads (0: one per core)"
     << std::endl << "  -c, --custom               Enable custom CWD implementation, it's aggressive by default"
     // << std::endl << "      --openWorldAssumption  Use Open World Assumption (default is Closed World)"
     << std::endl;
@@ -183,9 +319,91 @@ bool isHelpPrint(const InputOptions &opts , char *argv0) {
     return true;
 }
 
+// Builds the graph once and solves every scenario of the input against it,
+// scenarios asking the same queries are solved as one batch
+int solveScenarios(const std::string &input) {
+    try {
+        auto [rules, scenarios] = parseTokensScenarios(tokenizer(input));
+
+        std::vector<Query> all_queries;
+        for (const auto &s : scenarios) {
+            for (const auto &q : s.queries)
+                all_queries.push_back(q);
+        }
+        Digraph digraph = makeDigraph({}, rules, all_queries);
+
+        std::map<std::string, std::vector<size_t>> batches;
+        for (size_t i = 0; i < scenarios.size(); i++) {
+            std::string key;
+            for (const auto &q : scenarios[i].queries)
+                key += q.label;
+            batches[key].push_back(i);
+        }
+
+        std::vector<std::string> conclusions(scenarios.size());
+        bool isError = false;
+        for (const auto &[_, batch] : batches) {
+            std::vector<std::vector<Fact>> facts;
+            for (size_t i : batch)
+                facts.push_back(scenarios[i].facts);
+            auto res = digraph.solveScenarios(facts, scenarios[batch.front()].queries);
+            for (size_t n = 0; n < batch.size(); n++) {
+                conclusions[batch[n]] = res[n].conclusion;
+                isError = isError || res[n].isError;
+            }
+        }
+
+        for (size_t i = 0; i < scenarios.size(); i++) {
+            std::cout << (i ? "\n" : "") << "=";
+            for (const auto &f : scenarios[i].facts)
+                std::cout << f.label;
+            std::cout << " ?";
+            for (const auto &q : scenarios[i].queries)
+                std::cout << q.label;
+            std::cout << "\n" << conclusions[i];
+        }
+        return isError ? 1 : 0;
+    } catch (std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+bool isDaemonLaunch(const InputOptions &opts) {
+    if (opts.daemonSocket.empty())
+        return false;
+    runDaemon(opts); // blocks on the socket
+    return true;
+}
+
+bool isStreamLaunch(const InputOptions &opts, int &ret) {
+    if (!opts.isStream)
+        return false;
+    if (!opts.file) {
+        std::cerr << "Error: --stream needs a rule file" << std::endl;
+        ret = 1;
+        return true;
+    }
+    std::ios::sync_with_stdio(false);
+    ret = runStream(opts, std::cin, std::cout);
+    return true;
+}
+
+bool isBatchLaunch(const InputOptions &opts, int &ret) {
+    if (opts.batch.empty())
+        return false;
+    std::ios::sync_with_stdio(false);
+    ret = runBatch(opts, std::cout);
+    return true;
+}
+
 bool isServerLaunch(const InputOptions &opts) {
     if (!opts.isServer)
         return false;
+    if (opts.workers > 0) {
+        runServerWorkers(opts); // blocks on the supervisor
+        return true;
+    }
     WebServer webServer(opts);
     webServer.start(); // blocks on the server
     return true;
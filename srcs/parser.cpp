@@ -6,6 +6,7 @@
 #include "expert-system.hpp"
 
 std::tuple<size_t, vector<Token>, string> getNextLine(const vector<Token> &tokens, size_t index);
+static Rule parseRuleLine(vector<Token> lineTokens, const string &comment);
 
 
 /*
@@ -17,9 +18,10 @@ std::tuple<size_t, vector<Token>, string> getNextLine(const vector<Token> &token
 ** - A vector of Query structs
 ** It processes the tokens to identify rules, facts, and queries based on their types and line numbers.
 ** It throws exceptions for syntax errors, such as missing facts or queries.
+** Without isQueryRequired a missing "?" line gives no queries instead.
 */
 std::tuple<vector<Rule>, vector<Fact>, vector<Query>>
-    parseTokens(const vector<Token> &input) {
+    parseTokens(const vector<Token> &input, bool isQueryRequired) {
     // take the list of tokens, split into lines then keep the comments to one side, and 
     // using the Parser.parse()
     if (input.empty())
@@ -29,8 +31,9 @@ std::tuple<vector<Rule>, vector<Fact>, vector<Query>>
     vector<Fact> facts = parseFacts(input);
 
     size_t facts_line_number = -1;
-    if (queries.empty())
+    if (queries.empty() && isQueryRequired)
         throw std::runtime_error("No queries found in input");
+    const size_t queries_line_number = queries.empty() ? -1 : queries[0].line_number;
     for (auto const &i : input) {
         if (i.type == Token::Type::Fact) {
             facts_line_number = i.line_number;
@@ -41,43 +44,200 @@ std::tuple<vector<Rule>, vector<Fact>, vector<Query>>
     size_t i = 0;
     while (i < input.size())
     {
-        if (input[i].line_number == queries[0].line_number ||
+        if (input[i].line_number == queries_line_number ||
             input[i].line_number == facts_line_number) {
             i++;
             continue; // skip facts and queries lines
         }
         auto [newI, lineTokens, comment] = getNextLine(input, i);
         i = newI;
-        if (!lineTokens.empty()) {
-            // TODO remove this now that the parser can do precedence
-            // add parentheses around the entire expression
-            // to be sure that the conclusion and the premis are well separated
-            lineTokens.push_back(Token(")", lineTokens[0].line_number, Token::Type::Parenthese));
-            lineTokens.insert(lineTokens.begin(), Token("(", lineTokens[0].line_number, Token::Type::Parenthese));
-            // insert parentheses before and after "=>", "<=>"
-            for (size_t j = 0; j < lineTokens.size(); j++) {
-                if (lineTokens[j].token_list == "=>" || lineTokens[j].token_list == "<=>") {
-                    lineTokens.insert(lineTokens.begin() + j, Token(")", lineTokens[0].line_number, Token::Type::Parenthese));
-                    lineTokens.insert(lineTokens.begin() + j + 2, Token("(", lineTokens[0].line_number, Token::Type::Parenthese));
-                    j += 2; // skip the newly added tokens
-                }
+        if (!lineTokens.empty())
+            rules.push_back(parseRuleLine(lineTokens, comment));
+    }
+
+    return {rules, facts, queries} ;
+};
+
+
+/*
+** parseTokensQueryCone implementation
+** ----------------------------
+** Same contract as parseTokens, but only the rules that can influence the
+** queries are parsed. A first pass over the tokens indexes every rule line by
+** the facts in its conclusion (both sides for "<=>") without building an Expr.
+** Starting from the queries we then walk backwards: a fact pulls in the rules
+** that conclude it, and a rule pulls in every fact it mentions, since solving
+** a rule can read its premis and set any fact of its conclusion.
+** Rules outside that cone are never parsed, syntax errors in them go unnoticed.
+*/
+std::tuple<vector<Rule>, vector<Fact>, vector<Query>>
+    parseTokensQueryCone(const vector<Token> &input) {
+    if (input.empty())
+        return {};
+    vector<Query> queries = parseQueries(input);
+    vector<Fact> facts = parseFacts(input);
+
+    size_t facts_line_number = -1;
+    if (queries.empty())
+        throw std::runtime_error("No queries found in input");
+    for (auto const &i : input) {
+        if (i.type == Token::Type::Fact) {
+            facts_line_number = i.line_number;
+        }
+    }
+
+    // [begin, end) token range of each rule line
+    vector<std::pair<size_t, size_t>> lines;
+    std::unordered_map<char, vector<size_t>> rulesByConsequent;
+
+    size_t i = 0;
+    while (i < input.size()) {
+        const size_t line_number = input[i].line_number;
+        const size_t begin = i;
+        bool isConsequent = false;
+        vector<char> lhs, rhs;
+        while (i < input.size() && input[i].line_number == line_number) {
+            const Token &t = input[i++];
+            if (t.token_list == "=>" || t.token_list == "<=>") {
+                isConsequent = true;
+                if (t.token_list == "<=>")
+                    rhs.insert(rhs.end(), lhs.begin(), lhs.end());
+            } else if (t.type == Token::Type::Variable) {
+                (isConsequent ? rhs : lhs).push_back(t.token_list[0]);
             }
-            Parser parser{0, lineTokens};
-
-            try {
-                Expr expr = parser.parse();
-                rules.push_back(Rule(expr, lineTokens[0].line_number, comment));
-                // printf("Parsed rule: %s\n", rules.back().toString().c_str());
-            } catch (const std::exception &e) {
-                std::stringstream ss;
-                ss << "Line: " << lineTokens[0].line_number << " :" << e.what() << std::endl;
-                throw std::runtime_error(ss.str());
+        }
+        if (line_number == queries[0].line_number || line_number == facts_line_number)
+            continue; // skip facts and queries lines
+        for (char f : rhs)
+            rulesByConsequent[f].push_back(lines.size());
+        lines.push_back({begin, i});
+    }
+
+    vector<bool> selected(lines.size(), false);
+    std::set<char> seen;
+    vector<char> pending;
+    for (const auto &q : queries) {
+        if (seen.insert(q.label).second)
+            pending.push_back(q.label);
+    }
+    while (!pending.empty()) {
+        char f = pending.back();
+        pending.pop_back();
+        auto it = rulesByConsequent.find(f);
+        if (it == rulesByConsequent.end())
+            continue;
+        for (size_t l : it->second) {
+            if (selected[l])
+                continue;
+            selected[l] = true;
+            for (size_t t = lines[l].first; t < lines[l].second; t++) {
+                if (input[t].type == Token::Type::Variable
+                        && seen.insert(input[t].token_list[0]).second)
+                    pending.push_back(input[t].token_list[0]);
             }
         }
     }
 
-    return {rules, facts, queries} ;
-};
+    vector<Rule> rules;
+    for (size_t l = 0; l < lines.size(); l++) {
+        if (!selected[l])
+            continue;
+        auto [_, lineTokens, comment] = getNextLine(input, lines[l].first);
+        if (!lineTokens.empty())
+            rules.push_back(parseRuleLine(lineTokens, comment));
+    }
+
+    return {rules, facts, queries};
+}
+
+
+/*
+** parseTokensScenarios implementation
+** ----------------------------
+** Multi-scenario input: every rule line comes first, then any number of
+** scenarios, each one a "=" facts line followed by its "?" queries line.
+** A "?" line with no "=" line before it is a scenario with no facts.
+** It throws for a rule line after the first scenario, a "=" line that is not
+** followed by a "?" line, or an input without any scenario.
+*/
+std::tuple<vector<Rule>, vector<Scenario>>
+    parseTokensScenarios(const vector<Token> &input) {
+    vector<Rule> rules;
+    vector<Scenario> scenarios;
+    std::optional<vector<Fact>> pendingFacts;
+    size_t pendingLine = 0;
+
+    size_t i = 0;
+    while (i < input.size()) {
+        const size_t begin = i;
+        const size_t line_number = input[i].line_number;
+        while (i < input.size() && input[i].line_number == line_number)
+            i++;
+        const vector<Token> line(input.begin() + begin, input.begin() + i);
+        // a line starts with the new line token ending the previous one
+        auto first_it = std::find_if(line.begin(), line.end(),
+            [](const Token &t) { return t.type != Token::Type::NewLine; });
+        const string first = first_it == line.end() ? "" : first_it->token_list;
+
+        if (first == "=") {
+            if (pendingFacts)
+                throw std::runtime_error("No queries for the facts of line: " + std::to_string(pendingLine));
+            pendingFacts.emplace(parseFacts(line));
+            pendingLine = line_number;
+        } else if (first == "?") {
+            scenarios.push_back({pendingFacts.value_or(vector<Fact>{}), parseQueries(line),
+                pendingFacts ? pendingLine : line_number});
+            pendingFacts.reset();
+        } else {
+            auto [_, lineTokens, comment] = getNextLine(input, begin);
+            if (lineTokens.empty())
+                continue;
+            if (!scenarios.empty() || pendingFacts)
+                throw std::runtime_error("Line: " + std::to_string(line_number) + " :Rules must come before the scenarios");
+            rules.push_back(parseRuleLine(lineTokens, comment));
+        }
+    }
+    if (pendingFacts)
+        throw std::runtime_error("No queries for the facts of line: " + std::to_string(pendingLine));
+    if (scenarios.empty())
+        throw std::runtime_error("No queries found in input");
+    return {rules, scenarios};
+}
+
+
+/*
+** parseRuleLine implementation
+** ----------------------------
+** Parses the tokens of a single rule line, without the new line and comment.
+** Parentheses are added around the premis and the conclusion so "=>" and "<=>"
+** always end up at the root of the expression.
+** Syntax errors are rethrown prefixed with the line number.
+*/
+static Rule parseRuleLine(vector<Token> lineTokens, const string &comment) {
+    // TODO remove this now that the parser can do precedence
+    // add parentheses around the entire expression
+    // to be sure that the conclusion and the premis are well separated
+    lineTokens.push_back(Token(")", lineTokens[0].line_number, Token::Type::Parenthese));
+    lineTokens.insert(lineTokens.begin(), Token("(", lineTokens[0].line_number, Token::Type::Parenthese));
+    // insert parentheses before and after "=>", "<=>"
+    for (size_t j = 0; j < lineTokens.size(); j++) {
+        if (lineTokens[j].token_list == "=>" || lineTokens[j].token_list == "<=>") {
+            lineTokens.insert(lineTokens.begin() + j, Token(")", lineTokens[0].line_number, Token::Type::Parenthese));
+            lineTokens.insert(lineTokens.begin() + j + 2, Token("(", lineTokens[0].line_number, Token::Type::Parenthese));
+            j += 2; // skip the newly added tokens
+        }
+    }
+    Parser parser{0, lineTokens};
+
+    try {
+        Expr expr = parser.parse();
+        return Rule(expr, lineTokens[0].line_number, comment);
+    } catch (const std::exception &e) {
+        std::stringstream ss;
+        ss << "Line: " << lineTokens[0].line_number << " :" << e.what() << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
 
 
 // make a get next line function that takes a tokens vector and return a new vector of just the line and the new index
@@ -181,3 +341,32 @@ std::vector<Query> parseQueries(const vector<Token> &input) {
     return queries;
 }
 
+
+
+/*
+** parseWhatIf implementation
+** ----------------------------
+** This function takes as input a line like "A !C" and returns the masks of
+** the facts to start True and False, bit 0 is A.
+** Spaces are ignored, a '!' applies to the letter right after it.
+** It throws an exception for any other character.
+*/
+std::pair<uint32_t, uint32_t> parseWhatIf(const std::string &line) {
+    uint32_t set_true = 0, set_false = 0;
+    bool negate = false;
+    for (char c : line) {
+        if (c == '!' && !negate) {
+            negate = true;
+        } else if (c >= 'A' && c <= 'Z') {
+            (negate ? set_false : set_true) |= 1u << (c - 'A');
+            negate = false;
+        } else if ((c != ' ' && c != '\t') || negate) {
+            throw std::runtime_error("Invalid character in what-if: " + std::string(1, c));
+        }
+    }
+    if (negate)
+        throw std::runtime_error("Expected a fact after '!'");
+    if (set_true & set_false)
+        throw std::runtime_error("A fact can't be both True and False");
+    return {set_true, set_false};
+}
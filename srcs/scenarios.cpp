@@ -0,0 +1,215 @@
+#include "expert-system.hpp"
+
+/*
+ * Scenarios
+ *
+ * The same rules evaluated against many different `=` lines. Each scenario
+ * is a mask of the facts it starts True, every other fact starts
+ * Undetermined and the closed world assumption is applied.
+ *
+ * When the rules are simple enough (see isBitSliceable) 64 scenarios are
+ * solved at once, one per bit of a word. Every fact gets two words, the lanes
+ * in which it is True and the lanes in which it is False, and the rules are
+ * applied bitwise in dependency order. Otherwise each distinct scenario is
+ * solved on its own context.
+ * */
+
+
+/* ** bit sliced three valued logic ** */
+
+namespace {
+
+struct Lanes {
+    uint64_t t; // lanes where the value is True
+    uint64_t f; // lanes where the value is False
+};
+
+struct LaneEvaluator {
+    const std::unordered_map<char, Lanes> &facts;
+
+    Lanes operator()(const Var &v) const { return facts.at(v.value()); }
+    Lanes operator()(const Not &n) const {
+        Lanes c = visit(*this, n.child());
+        return {c.f, c.t};
+    }
+    Lanes operator()(const And &n) const {
+        Lanes l = visit(*this, n.lhs()), r = visit(*this, n.rhs());
+        return {l.t & r.t, l.f | r.f};
+    }
+    Lanes operator()(const Or &n) const {
+        Lanes l = visit(*this, n.lhs()), r = visit(*this, n.rhs());
+        return {l.t | r.t, l.f & r.f};
+    }
+    Lanes operator()(const Xor &n) const {
+        Lanes l = visit(*this, n.lhs()), r = visit(*this, n.rhs());
+        return {(l.t & r.f) | (l.f & r.t), (l.t & r.t) | (l.f & r.f)};
+    }
+    Lanes operator()(const Empty &) const { return {0, 0}; }
+    Lanes operator()(const Imply &) const { return {0, 0}; }
+    Lanes operator()(const Iff &) const { return {0, 0}; }
+};
+
+uint32_t factMask(const std::vector<Fact> &facts) {
+    uint32_t mask = 0;
+    for (const auto &f : facts) {
+        if (f.state == Fact::State::True)
+            mask |= 1u << (f.label - 'A');
+    }
+    return mask;
+}
+
+} // namespace
+
+
+// The bitwise pass models the solver on acyclic rule sets made only of
+// `lhs => X` rules, X a single fact that is not in lhs. There every fact is
+// solved once, after everything it depends on, and ends up:
+// - True if it starts True or the lhs of one of its rules is True
+// - False if not, and the lhs of one of its rules is False while that rule is
+//   a leaf: the rules concluding its antecedents were all found useless
+// - Undetermined otherwise, those lanes are left to solveScenario
+// A rule is found useless when its fact is still Undetermined, its lhs is
+// False and it is a leaf, so all the rules of a fact are useless when it did
+// not start True and each of them is.
+bool Digraph::isBitSliceable() const {
+    if (!frozen)
+        return false;
+    for (const auto &scc : sccs) {
+        if (scc.isCyclic)
+            return false;
+    }
+    for (const auto &[_, rule] : rules) {
+        auto imply = std::get_if<Imply>(&rule.expr);
+        if (!imply)
+            return false;
+        auto var = std::get_if<Var>(&imply->rhs());
+        if (!var || imply->lhs().containes(*var))
+            return false;
+    }
+    return true;
+}
+
+
+std::vector<Digraph::ScenarioRes> Digraph::solveScenarios(
+        const std::vector<std::vector<Fact>> &scenarios,
+        const std::vector<Query> &queries) const {
+    std::vector<ScenarioRes> res(scenarios.size());
+
+    uint32_t cone = 0;
+    for (const auto &q : queries)
+        cone |= dependencyCone(q.label);
+
+    // scenarios that agree on the facts the queries can see share a result
+    std::unordered_map<uint32_t, size_t> solved;
+    auto solveScalar = [&](size_t s) {
+        const uint32_t initial = factMask(scenarios[s]) & cone;
+        auto it = solved.find(initial);
+        if (it != solved.end()) {
+            res[s] = res[it->second];
+            return;
+        }
+        res[s] = solveScenario(initial, queries);
+        solved[initial] = s;
+    };
+
+    if (!isBitSliceable()) {
+        for (size_t s = 0; s < scenarios.size(); s++)
+            solveScalar(s);
+        return res;
+    }
+
+    std::unordered_map<char, Lanes> lanes;
+    for (size_t base = 0; base < scenarios.size(); base += 64) {
+        const size_t n = std::min<size_t>(64, scenarios.size() - base);
+        const uint64_t all = n == 64 ? ~0ull : (1ull << n) - 1;
+
+        std::unordered_map<char, uint64_t> initial;
+        for (size_t l = 0; l < n; l++) {
+            const uint32_t mask = factMask(scenarios[base + l]);
+            for (const auto &[id, _] : facts) {
+                if (mask & (1u << (id - 'A')))
+                    initial[id] |= 1ull << l;
+            }
+        }
+
+        // sccs is in dependency order and every component is a single fact
+        std::unordered_map<char, uint64_t> all_useless;
+        for (const auto &scc : sccs) {
+            const char id = scc.facts.front();
+            const Fact &fact = facts.at(id);
+            const uint64_t start = initial[id];
+            if (fact.consequent_rules.empty()) {
+                // closed world assumption
+                lanes[id] = {start, ~start & all};
+                all_useless[id] = all;
+                continue;
+            }
+            uint64_t t = start, useless_any = 0, useless_all = all;
+            for (const auto &r_id : fact.consequent_rules) {
+                const Rule &rule = rules.at(r_id);
+                Lanes lhs = visit(LaneEvaluator{lanes}, std::get<Imply>(rule.expr).lhs());
+                uint64_t leaf = all;
+                for (char a : rule.antecedent_facts)
+                    leaf &= all_useless.at(a);
+                t |= lhs.t;
+                useless_any |= lhs.f & leaf;
+                useless_all &= lhs.f & leaf;
+            }
+            lanes[id] = {t, useless_any & ~t};
+            all_useless[id] = useless_all & ~start;
+        }
+
+        for (size_t l = 0; l < n; l++) {
+            ScenarioRes &out = res[base + l];
+            std::ostringstream conclusion;
+            bool isDetermined = true;
+            for (const auto &q : queries) {
+                const Lanes &ql = lanes.at(q.label);
+                const Fact::State state = (ql.t >> l) & 1 ? Fact::State::True
+                    : (ql.f >> l) & 1 ? Fact::State::False : Fact::State::Undetermined;
+                isDetermined = isDetermined && state != Fact::State::Undetermined;
+                out.states.push_back(state);
+                out.errors.push_back(false);
+                conclusion << q.label << " is " << state << std::endl;
+            }
+            out.conclusion = conclusion.str();
+            out.isError = false;
+            if (!isDetermined) {
+                out.states.clear();
+                out.errors.clear();
+                solveScalar(base + l);
+            }
+        }
+    }
+    return res;
+}
+
+
+// One scenario the way main solves a file: closed world assumption, then
+// every query in order on the same context
+Digraph::ScenarioRes Digraph::solveScenario(uint32_t initial, const std::vector<Query> &queries,
+        const QueryCompiler &compile) const {
+    SolveContext ctx = newContext();
+    for (const auto &[id, _] : facts) {
+        if (initial & (1u << (id - 'A')))
+            setFactState(ctx, id, Fact::State::True);
+    }
+    applyWorldAssumption(ctx, false);
+
+    std::vector<std::shared_ptr<const Expr>> exprs;
+    for (const auto &q : queries) {
+        exprs.push_back(compile ? compile(ctx, q.label)
+            : std::make_shared<const Expr>(compileExprForFact(ctx, q.label)));
+    }
+
+    ScenarioRes res{{}, {}, {}, false};
+    std::ostringstream conclusion, explanation;
+    for (size_t i = 0; i < queries.size(); i++) {
+        auto state = answerQuery(ctx, queries[i], *exprs[i], conclusion, explanation);
+        res.states.push_back(state.value_or(Fact::State::Undetermined));
+        res.errors.push_back(!state);
+        res.isError = res.isError || !state;
+    }
+    res.conclusion = conclusion.str();
+    return res;
+}
@@ -1,5 +1,10 @@
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <cerrno>
 #include <iostream>
 #include <sstream>
 #include <csignal>
@@ -7,13 +12,24 @@
 #include "expert-system.hpp"
 #include "parser.hpp"
 #include "server.hpp"
+#include "stream.hpp"
+#include "http.hpp"
+#include "result_cache.hpp"
 
 static std::string urlDecode(const std::string &src);
-static std::string genGraphImg(const Digraph &digraph);
+static std::optional<std::string> queryValue(const std::string &queryParam, const std::string &name);
+static std::string graphHTML(const std::string &key, const std::string &dot = "");
+#ifdef WITH_GRAPHVIZ
+static const bool withGraphviz = true;
+#else
+static const bool withGraphviz = false;
+#endif
 static std::string footer();
+static std::string statusLine(int status);
+static const std::string sessionsRefused =
+    "Error: sessions are kept by a single server process, run it without --workers\n";
 
 WebServer* g_server = nullptr;
-bool running = true;
 
 void handleSigint(int) {
     std::cout << "\nSigint...\n";
@@ -21,16 +37,25 @@ void handleSigint(int) {
     exit(0);
 }
 
-WebServer::WebServer(const InputOptions &opts) : opts(opts) {
+WebServer::WebServer(const InputOptions &opts)
+    : opts(opts), sessions(opts.sessionMemory << 20), cache(opts.cacheMemory << 20),
+      graphs(opts.cacheMemory << 20, opts.graphFormat) {
 
     prefillRuleset = opts.file ? getFileInput(opts.file) : "";
+    // what changes the answer besides the rules, the what-ifs follow it
+    cacheOptions = std::string("lazy=") + (opts.isLazy ? "1" : "0")
+        + " explain=" + (opts.isExplain ? "1" : "0")
+        + " owa=" + (opts.isOpenWorldAssumption ? "1" : "0") + "\n";
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     if (server_fd < 0) { perror("socket"); exit(1); }
 
     int opt = 1;
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         perror("setsockopt"); exit(1); }
+    // worker processes each bind their own socket to the port
+    if (opts.workers > 0 && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt"); exit(1); }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
@@ -38,115 +63,313 @@ WebServer::WebServer(const InputOptions &opts) : opts(opts) {
     addr.sin_port = htons(opts.port);
 
     if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {perror("bind"); exit(1); }
-    if (listen(server_fd, 10) < 0) { perror("listen"); exit(1); }
+    socklen_t addrLen = sizeof(addr);
+    if (getsockname(server_fd, (sockaddr*)&addr, &addrLen) < 0) { perror("getsockname"); exit(1); }
+    listenPort = ntohs(addr.sin_port);
+    if (listen(server_fd, opts.backlog) < 0) { perror("listen"); exit(1); }
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) { perror("epoll_create1"); exit(1); }
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0) { perror("eventfd"); exit(1); }
+    for (int fd : {server_fd, wake_fd}) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) { perror("epoll_ctl"); exit(1); }
+    }
+
+    // the cores are shared between the worker processes
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    workers.emplace(opts.threads ? opts.threads : std::max<size_t>(1, cores / std::max<size_t>(1, opts.workers)));
 
-    std::cout << "Server listening on port " << opts.port << "...\n";
+    std::cout << "Server listening on port " << listenPort << " with "
+              << workers->size() << " threads...\n";
 
     registerGetRoutes();
+    registerPostRoutes();
 }
 
 WebServer::~WebServer() {
+    workers.reset(); // responses still being computed go to wake_fd
+    for (const auto &[client, _] : connections)
+        close(client);
     if (server_fd != -1 && close(server_fd) != 0) perror("destructor close");
+    close(epoll_fd);
+    close(wake_fd);
 }
 
-static std::string favicon();
+static const std::string &favicon();
+
+// The facts and queries params, the file's `=` and `?` lines when missing
+static StreamRecord paramsRecord(const RuleFile &file, const std::string &params, const std::string &id) {
+    StreamRecord record{id, file.facts, {}, ""};
+    for (const auto &q : file.queries)
+        record.queries.push_back(q);
+    try {
+        if (auto facts = queryValue(params, "facts"))
+            record.facts = KnowledgeBase::factMask(facts->starts_with("=") ? facts->substr(1) : *facts);
+        if (auto queries = queryValue(params, "queries")) {
+            std::vector<Query> list = KnowledgeBase::queryList(queries->starts_with("?") ? queries->substr(1) : *queries);
+            record.queries.clear();
+            for (const auto &q : list)
+                record.queries.push_back(q);
+        }
+        if (record.queries.empty())
+            throw std::runtime_error("No queries");
+    } catch (std::exception &e) {
+        record.error = e.what();
+    }
+    return record;
+}
 
 void WebServer::registerGetRoutes() {
-    get_routes["/"] = [this](std::string queryParam) -> std::string {
+    get_routes["/"] = [this](std::string queryParam) -> HttpResponse {
         (void)queryParam;
         std::ostringstream body;
         body << "<h1>Expert System</h1>\n"
         << "<p>Enter your ruleset here</p>\n"
-        << "<form action=\"evaluate\" method=\"get\">\n"
+        << "<form action=\"evaluate\" method=\"post\">\n"
         << "    <textarea name=\"rules\" placeholder=\"Enter your ruleset here...\">" << prefillRuleset << "</textarea><br>\n"
+        << "    <input name=\"whatif\" placeholder=\"What if, e.g. A !C; B\"><br>\n"
         << "    <button type=\"submit\">Submit</button>\n"
         << "</form>\n";
         return constructHTMLResponse(Status::OK, body.str());
     };
 
-    get_routes["/evaluate"] = [this](std::string queryParam) -> std::string {
-        std::string rules;
-        std::string key = "rules=";
-        size_t pos = queryParam.find(key);
-        if (pos != std::string::npos) {
-            rules = urlDecode(queryParam.substr(pos + key.length()));
-        } else {
-            rules = "# No rules submitted.";
-        }
-
-        std::ostringstream report;
-        std::string img;
+    get_routes["/evaluate"] = [this](std::string queryParam) -> HttpResponse {
+        return evaluatePage(queryParam);
+    };
 
+    // Sessions, the rules are uploaded once and then only facts and queries
+    // are sent, see session.hpp:
+    //   /session?rules=...                          -> handle
+    //   /session/evaluate?session=H&facts=AB&queries=C -> stream.hpp JSON
+    get_routes["/session"] = [this](std::string queryParam) -> HttpResponse {
         try {
-            std::vector<Token> tokens = tokenizer(rules);
-            auto [rules, facts, queries] = parseTokens(tokens);
-            Digraph digraph = makeDigraph(facts, rules, queries);
-            digraph.isExplain = opts.isExplain;
-            img = genGraphImg(digraph);
-            digraph.applyWorldAssumption(opts.isOpenWorldAssumption);
-
-            auto [conclusion, explanation, isError] = digraph.solveEverythingNoThrow(queries);
-            report << "CONCLUSION\n"  << conclusion << "\n"
-                   << "EXPLANATION\n" << explanation;
-            (void)isError;
-
+            std::string handle = sessions.add(queryValue(queryParam, "rules").value_or(""));
+            return constructResponse(Status::OK, "text/plain", handle + "\n");
         } catch (std::exception &e) {
-            report << "Error: " << e.what() << std::endl;
+            return constructResponse(Status::BAD_REQUEST, "text/plain",
+                std::string("Error: ") + e.what() + "\n");
         }
+    };
 
+    get_routes["/session/evaluate"] = [this](std::string queryParam) -> HttpResponse {
+        const std::string handle = queryValue(queryParam, "session").value_or("");
+        std::shared_ptr<const RuleFile> file = sessions.get(handle);
+        if (!file)
+            return constructResponse(Status::NOT_FOUND, "application/json",
+                streamError("null", "Unknown session") + "\n");
+        // handles are hex, the id needs no escaping
+        StreamRecord record = paramsRecord(*file, queryParam, "\"" + handle + "\"");
+        return constructResponse(record.error.empty() ? Status::OK : Status::BAD_REQUEST,
+            "application/json", answerStreamRecord(*file, record) + "\n");
+    };
 
-        std::ostringstream body;
-        body << "<h1>Evaluation</h1>\n"
-            << "<p>Submitted rules</p>\n"
-            << "<pre>" << rules << "</pre>\n"
-            << "<p>RESULTS</p>\n"
-            << "<pre>" << report.str() << "</pre>\n"
-            << "<p>Node digraph</p>"
-            << img
-            << "<a href=\"/\">Back</a>\n";
+    // every worker process would keep sessions of its own, while the kernel
+    // hands a client's connections to any of them
+    if (opts.workers > 0) {
+        for (const char *path : {"/session", "/session/evaluate"}) {
+            get_routes[path] = [this](std::string queryParam) -> HttpResponse {
+                (void)queryParam;
+                return constructResponse(Status::NOT_IMPLEMENTED, "text/plain", sessionsRefused);
+            };
+        }
+    }
 
-        return constructHTMLResponse(Status::OK, body.str());
+    get_routes["/cache"] = [this](std::string queryParam) -> HttpResponse {
+        (void)queryParam;
+        return constructResponse(Status::OK, "application/json",
+            "{\"entries\":" + std::to_string(cache.size())
+            + ",\"bytes\":" + std::to_string(cache.memory())
+            + ",\"hits\":" + std::to_string(cache.hits())
+            + ",\"misses\":" + std::to_string(cache.misses())
+            + ",\"coalesced\":" + std::to_string(cache.coalesced()) + "}\n");
     };
 
-    get_routes["/favicon.ico"] = [this](std::string queryParam) -> std::string {
+    get_routes["/favicon.ico"] = [this](std::string queryParam) -> HttpResponse {
         (void)queryParam;
         (void)this;
-        std::ostringstream response;
-        std::string icon = favicon();
-        response << "HTTP/1.1 200\r\n"
-                << "Content-Type: image/svg+xml; charset=UTF-8\r\n"
-                << "Connection : close\r\n"
-                << "Content-Length: " << icon.size() << "\r\n"
-                << "Cache-Control: public, max-age=31536000, immutable\r\n"
-                << "\r\n"
-                << icon;
+        HttpResponse response;
+        response.head = statusLine(200) +
+                        "Content-Type: image/svg+xml; charset=UTF-8\r\n"
+                        "Cache-Control: public, max-age=31536000, immutable\r\n";
+        response.appendStatic(favicon());
         std::cout << "Returning icon\n";
-        return response.str();
+        return response;
     };
 }
 
-std::string WebServer::parsePath(const std::string& request) const {
-    size_t start = request.find(' ') + 1;
-    size_t end = request.find_first_of(" ?", start);
-    return request.substr(start, end - start);
+// Bodies are read whole, whatever their size or transfer encoding
+void WebServer::registerPostRoutes() {
+    // the web form, its fields in the body instead of the URL
+    post_routes["/evaluate"] = [this](const std::string &queryParam, const std::string &body) -> HttpResponse {
+        (void)queryParam;
+        return evaluatePage(body);
+    };
+
+    // The body is a rule file as the CLI reads it, the facts and queries
+    // params override its `=` and `?` lines. Answers stream.hpp JSON.
+    post_routes["/api/evaluate"] = [this](const std::string &queryParam, const std::string &body) -> HttpResponse {
+        try {
+            RuleFile file = parseRuleFile("request", body);
+            StreamRecord record = paramsRecord(file, queryParam, "null");
+            return constructResponse(record.error.empty() ? Status::OK : Status::BAD_REQUEST,
+                "application/json", answerStreamRecord(file, record) + "\n");
+        } catch (std::exception &e) {
+            return constructResponse(Status::BAD_REQUEST, "application/json",
+                streamError("null", e.what()) + "\n");
+        }
+    };
+
+    // the rules as the body, see the GET route
+    post_routes["/session"] = [this](const std::string &queryParam, const std::string &body) -> HttpResponse {
+        (void)queryParam;
+        try {
+            std::string handle = sessions.add(body);
+            return constructResponse(Status::OK, "text/plain", handle + "\n");
+        } catch (std::exception &e) {
+            return constructResponse(Status::BAD_REQUEST, "text/plain",
+                std::string("Error: ") + e.what() + "\n");
+        }
+    };
+    if (opts.workers > 0) {
+        post_routes["/session"] = [this](const std::string &queryParam, const std::string &body) -> HttpResponse {
+            (void)queryParam;
+            (void)body;
+            return constructResponse(Status::NOT_IMPLEMENTED, "text/plain", sessionsRefused);
+        };
+    }
 }
 
-std::string WebServer::parseQueryString(const std::string &request) const {
-    size_t endFirstLine = request.find("\r\n");
-    size_t start = request.find('?');
-    if (start == std::string::npos || start > endFirstLine)
-        return "";
-    start += 1;
-    size_t end = request.find(" ", start);
-    return request.substr(start, end - start);
+// Conclusion, explanation, what-ifs and graph of the rules, errors are kept
+// in the report as they are answered the same every time
+std::shared_ptr<const Evaluation> WebServer::evaluate(const std::vector<Token> &tokens,
+        const std::string &whatIfs) {
+    auto res = std::make_shared<Evaluation>();
+    std::ostringstream report;
+
+    try {
+        auto [rules, facts, queries] = opts.isLazy
+            ? parseTokensQueryCone(tokens) : parseTokens(tokens);
+        Digraph digraph = makeDigraph(facts, rules, queries);
+        digraph.isExplain = opts.isExplain;
+        // rendered apart, the answer does not wait for the layout. Another
+        // worker process may get the /graph request, so there the link
+        // carries the DOT for whichever renders it.
+        if (withGraphviz) {
+            std::ostringstream dot;
+            digraph.writeDot(dot, queryCone(queries, opts.dotDepth, opts.dotFanIn));
+            res->dot = std::move(dot).str();
+        }
+        if (withGraphviz && opts.workers > 0) {
+            res->img = graphHTML(graphs.key(res->dot), res->dot);
+            res->dot.clear();
+        } else {
+            res->img = graphHTML(withGraphviz ? graphs.key(res->dot) : "");
+        }
+        digraph.applyWorldAssumption(opts.isOpenWorldAssumption);
+
+        auto [conclusion, explanation, isError] = opts.jobs > 1
+            ? digraph.solveQueriesParallel(queries, opts.jobs)
+            : digraph.solveEverythingNoThrow(queries);
+        res->conclusion = std::move(conclusion);
+        res->explanation = std::move(explanation);
+        res->isSolved = true;
+
+        if (!isError && !whatIfs.empty()) {
+            Digraph::Snapshot snap = digraph.snapshot();
+            std::istringstream branches(whatIfs);
+            std::string branch;
+            while (std::getline(branches, branch, ';')) {
+                auto [set_true, set_false] = parseWhatIf(branch);
+                report << "\nWHAT IF " << branch << "\n"
+                       << digraph.whatIf(snap, set_true, set_false, queries).result().conlusion;
+            }
+        }
+
+    } catch (std::exception &e) {
+        report << "Error: " << e.what() << std::endl;
+    }
+    res->report = std::move(report).str();
+    return res;
+}
+
+// The results page, params are those of the form (url encoded): rules and
+// the optional whatif. Results come from the cache when the same tokens
+// were answered with the same what-ifs, and are sent from there.
+HttpResponse WebServer::evaluatePage(const std::string &params) {
+    std::string rules = queryValue(params, "rules").value_or("");
+    if (rules.empty())
+        rules = "# No rules submitted.";
+    // ';' separated branches, each answered against the same solved graph
+    std::string whatIfs = queryValue(params, "whatif").value_or("");
+
+    std::shared_ptr<const Evaluation> res;
+    try {
+        std::vector<Token> tokens = tokenizer(rules);
+        const std::string key = ResultCache::keyOf(tokens, cacheOptions + whatIfs);
+        // the same rules sent by many at once are answered once
+        res = cache.getOrCompute(key, [&] { return evaluate(tokens, whatIfs); });
+        // again if its render was dropped since
+        if (withGraphviz && !res->dot.empty())
+            graphs.queue(res->dot);
+    } catch (std::exception &e) {
+        auto error = std::make_shared<Evaluation>();
+        error->report = std::string("Error: ") + e.what() + "\n";
+        res = std::move(error);
+    }
+    // the strings of the cached result, kept alive by the response
+    auto part = [&res](const std::string &member) {
+        return std::shared_ptr<const std::string>(res, &member);
+    };
+
+    HttpResponse content;
+    content.appendStatic("<h1>Evaluation</h1>\n"
+                         "<p>Submitted rules</p>\n"
+                         "<pre>");
+    content.append(std::move(rules));
+    content.appendStatic("</pre>\n"
+                         "<p>RESULTS</p>\n"
+                         "<pre>");
+    if (res->isSolved) {
+        content.appendStatic("CONCLUSION\n");
+        content.appendShared(part(res->conclusion));
+        content.appendStatic("\nEXPLANATION\n");
+        content.appendShared(part(res->explanation));
+    }
+    content.appendShared(part(res->report));
+    content.appendStatic("</pre>\n"
+                         "<p>Node digraph</p>");
+    content.appendShared(part(res->img));
+    content.appendStatic("<a href=\"/\">Back</a>\n");
+
+    return constructHTMLResponse(Status::OK, std::move(content));
+}
+
+
+// "HTTP/1.1 404 Not Found", with its CRLF
+static std::string statusLine(int status) {
+    const char *reason = "";
+    switch (status) {
+        case 200: reason = "OK"; break;
+        case 400: reason = "Bad Request"; break;
+        case 404: reason = "Not Found"; break;
+        case 413: reason = "Payload Too Large"; break;
+        case 431: reason = "Request Header Fields Too Large"; break;
+        case 500: reason = "Internal Server Error"; break;
+        case 501: reason = "Not Implemented"; break;
+        case 505: reason = "HTTP Version Not Supported"; break;
+    }
+    return "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
 }
 
-std::string WebServer::parseMethod(const std::string& request) const {
-    size_t end = request.find(" ");
-    return request.substr(0, end);
+static std::string statusHead(int status, const std::string &contentType) {
+    return statusLine(status) + "Content-Type: " + contentType + "; charset=UTF-8\r\n";
 }
 
-std::string WebServer::constructHTMLResponse(Status status, const std::string& body="") const {
+HttpResponse WebServer::constructHTMLResponse(Status status, const std::string& body) const {
     auto defaultBody = [status]() -> std::string {
         switch (status) {
             case Status::OK:
@@ -160,117 +383,431 @@ std::string WebServer::constructHTMLResponse(Status status, const std::string& b
         }
     };
 
-    std::string htmlBody = body.empty() ? defaultBody() : body;
+    HttpResponse content;
+    content.append(body.empty() ? defaultBody() : body);
+    return constructHTMLResponse(status, std::move(content));
+}
+
+// The page template around content, its fixed parts are sent from static
+// storage
+HttpResponse WebServer::constructHTMLResponse(Status status, HttpResponse &&content) const {
 
 // #748873
 // #D1A980
 // #E5E0D8
 // #F8F8F8
 
-    std::ostringstream fullHtml;
-    fullHtml << "<!DOCTYPE html>\n"
-             << "<html lang=\"en\">\n"
-             << "<head>\n"
-             << "  <meta charset=\"UTF-8\">\n"
-             << "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
-             << "  <title>Expert System</title>\n"
-             << "  <style>\n"
-             << "    body { font-family: sans-serif; margin: 0 auto; text-align: center; color: #748873; background-color: #E5E0D8; max-width: 70ch; height: 100vh; display: flex; flex-direction: column; justify-content: space-between; gap: 2rem;} \n"
-             << "    textarea { width: 90%; height: 200px; margin: 1em 0; font-family: monospace; }\n"
-             << "    button { padding: 0.5em 1.5em; font-size: 1em; cursor: pointer; color: #D1A980; }\n"
-             << "    pre { text-align: left; overflow-x: auto; background-color: #F8F8F8; padding: 1.1em; border: solid; }\n"
-             << "    a { color: #D1A980; }\n a:visited { color: #b48e68; }\n"
-             << "    img { border: solid; display: block; width: 100%; width: -moz-available; width: -webkit-fill-available; width: stretch; margin: auto; }\n"
-             << "  </style>\n"
-             << "</head>\n"
-             << "<body>\n"
-             << "<main>\n"
-             << htmlBody << "\n"
-             << "</main>\n"
-             << footer() << "\n"
-             << "</body>\n"
-             << "</html>";
-
-    std::string responseBody = fullHtml.str();
-
-    std::ostringstream response;
-        response << "HTTP/1.1 " << static_cast<std::underlying_type<Status>::type>(status) << "\r\n"
-                << "Content-Type: text/html; charset=UTF-8\r\n"
-                << "Connection : close\r\n"
-                << "Content-Length: " << responseBody.size() << "\r\n"
-                << "\r\n"
-                << responseBody;
-    return response.str();
+    static const std::string top =
+        "<!DOCTYPE html>\n"
+        "<html lang=\"en\">\n"
+        "<head>\n"
+        "  <meta charset=\"UTF-8\">\n"
+        "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\n"
+        "  <title>Expert System</title>\n"
+        "  <style>\n"
+        "    body { font-family: sans-serif; margin: 0 auto; text-align: center; color: #748873; background-color: #E5E0D8; max-width: 70ch; height: 100vh; display: flex; flex-direction: column; justify-content: space-between; gap: 2rem;} \n"
+        "    textarea { width: 90%; height: 200px; margin: 1em 0; font-family: monospace; }\n"
+        "    button { padding: 0.5em 1.5em; font-size: 1em; cursor: pointer; color: #D1A980; }\n"
+        "    pre { text-align: left; overflow-x: auto; background-color: #F8F8F8; padding: 1.1em; border: solid; }\n"
+        "    a { color: #D1A980; }\n a:visited { color: #b48e68; }\n"
+        "    img { border: solid; display: block; width: 100%; width: -moz-available; width: -webkit-fill-available; width: stretch; margin: auto; }\n"
+        "  </style>\n"
+        "</head>\n"
+        "<body>\n"
+        "<main>\n";
+    static const std::string bottom = "\n</main>\n" + footer() + "\n</body>\n</html>";
+
+    HttpResponse response;
+    response.head = statusHead(static_cast<std::underlying_type<Status>::type>(status), "text/html");
+    response.appendStatic(top);
+    response.append(std::move(content));
+    response.appendStatic(bottom);
+    return response;
+}
+
+HttpResponse WebServer::constructResponse(Status status, const std::string& contentType, std::string body) const {
+    HttpResponse response;
+    response.head = statusHead(static_cast<std::underlying_type<Status>::type>(status), contentType);
+    response.append(std::move(body));
+    return response;
 }
 
 void WebServer::start() {
     g_server = this;
     std::signal(SIGINT, handleSigint);
+    std::signal(SIGPIPE, SIG_IGN); // a client closing early is seen by send
 
+    std::vector<epoll_event> events(256);
     while (running) {
-        int client = accept(server_fd, nullptr, nullptr);
+        // wakes up every second for the idle connections
+        int n = epoll_wait(epoll_fd, events.data(), events.size(), 1000);
+        wakeupCount++;
+        if (n < 0) {
+            if (errno != EINTR) { perror("epoll_wait"); break; }
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == server_fd)
+                acceptClients();
+            else if (fd == wake_fd)
+                collectResponses();
+            else if (events[i].events & (EPOLLERR | EPOLLHUP))
+                closeClient(fd);
+            else {
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                    readClient(fd);
+                if ((events[i].events & EPOLLOUT) && connections.count(fd))
+                    writeClient(fd);
+            }
+        }
+        checkTimeouts();
+    }
+
+    if (server_fd != -1) {
+        if (shutdown(server_fd, SHUT_RDWR)) { perror("shutdown"); } // shutdown accept, but seems a bit buggy to me
+        if (close(server_fd) != 0) { perror("close"); }
+        server_fd = -1;
+    }
+}
+
+// The loop closes the listening socket itself, it may be in accept meanwhile
+void WebServer::stop() {
+    running = false;
+    std::cout<< "  ...closing server." << std::endl;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) perror("eventfd write");
+}
+
+
+void WebServer::acceptClients() {
+    while (true) {
+        int client = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK);
         if (client < 0) {
-            if (!running) perror("accept"); // for force shutdown 
-            continue; 
+            if (errno != EAGAIN && errno != EWOULDBLOCK && running) perror("accept");
+            return;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = client;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &ev) < 0) {
+            perror("epoll_ctl");
+            close(client);
+            continue;
+        }
+        Connection &conn = connections[client] = Connection{};
+        conn.parser = HttpParser(opts.maxBody << 20);
+        conn.events = ev.events;
+        conn.lastActive = std::chrono::steady_clock::now();
+    }
+}
+
+// Sets what the loop waits for on client. Requests pipelined behind the
+// one being answered are read ahead up to MAX_PIPELINED bytes.
+void WebServer::watch(int client) {
+    Connection &conn = connections[client];
+    if (conn.isClosed)
+        return;
+    const bool isWriting = conn.sent < conn.response.size();
+    epoll_event ev{};
+    ev.data.fd = client;
+    if (!conn.isEof && !conn.isClosed
+            && (!(conn.isBusy || isWriting) || conn.parser.buffered() < MAX_PIPELINED))
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (isWriting)
+        ev.events |= EPOLLOUT;
+    if (ev.events != conn.events && epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client, &ev) == 0)
+        conn.events = ev.events;
+}
+
+void WebServer::readClient(int client) {
+    Connection &conn = connections[client];
+    char buffer[16384];
+
+    while (true) {
+        ssize_t bytes = read(client, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            conn.parser.feed(buffer, bytes);
+            if ((conn.isBusy || conn.sent < conn.response.size()) && conn.parser.buffered() >= MAX_PIPELINED)
+                break;
+        } else if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break; // more to come
+        } else if (bytes < 0 && errno == EINTR) {
+            continue;
+        } else {
+            conn.isEof = true; // what is buffered is still answered
+            break;
         }
+    }
+    conn.lastActive = std::chrono::steady_clock::now();
+    nextRequest(client);
+}
 
-            std::string request = readFullFequest(client);
-            if (request.length() > 0) {
+// Answers the next parsed request once the previous response is out, so
+// pipelined requests get their responses in order
+void WebServer::nextRequest(int client) {
+    Connection &conn = connections[client];
+    if (conn.isBusy || conn.sent < conn.response.size()) {
+        watch(client);
+        return;
+    }
 
-                std::string method = parseMethod(request);
-                std::string path = parsePath(request);
-                std::string queryString = parseQueryString(request);
+    if (conn.parser.hasError() || (conn.isEof && !conn.parser.hasRequest() && conn.parser.isStarted())) {
+        // the rest of the input cannot be trusted, answer and close
+        Status status = conn.parser.hasError() ? static_cast<Status>(conn.parser.errorStatus()) : Status::BAD_REQUEST;
+        std::string message = conn.parser.hasError() ? conn.parser.errorMessage() : "Incomplete request";
+        conn.response = constructResponse(status, "text/plain", "Error: " + message + "\n");
+        conn.response.finish(false);
+        conn.isKeepAlive = false;
+        writeClient(client);
+        return;
+    }
+    if (!conn.parser.hasRequest()) {
+        if (conn.isEof) {
+            closeClient(client);
+        } else if (conn.parser.takeContinue()) {
+            // the client waits for this before sending the body
+            conn.response.head = "HTTP/1.1 100 Continue\r\n\r\n";
+            conn.isKeepAlive = true;
+            writeClient(client);
+        } else {
+            watch(client);
+        }
+        return;
+    }
 
-                std::cout   << "\nREQUEST\n"
-                            // << "method: {" << method << "}\n"
-                            << "path: {" << path << "}\n"
-                            << "queryStrings: {"<< queryString << "}\n"
-                            // << "requst {\n" << request 
-                            ;
+    HttpRequest request = conn.parser.take();
+    conn.isKeepAlive = request.isKeepAlive();
+    conn.isBusy = true;
+    conn.since = std::chrono::steady_clock::now();
+    watch(client);
+
+    workers->submit([this, client, request = std::move(request), keepAlive = conn.isKeepAlive] {
+        HttpResponse response = respond(request, keepAlive);
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done.emplace_back(client, std::move(response));
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) perror("eventfd write");
+    });
+}
 
-                std::string response = constructHTMLResponse(Status::NOT_FOUND);
+void WebServer::collectResponses() {
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("eventfd read");
 
-                if (method == "GET" && get_routes.find(path) != get_routes.end())
-                    response = get_routes[path](queryString);
+    std::vector<std::pair<int, HttpResponse>> ready;
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        ready.swap(done);
+    }
+    for (auto &[client, response] : ready) {
+        Connection &conn = connections[client];
+        conn.isBusy = false;
+        if (conn.isClosed) {
+            closeClient(client);
+            continue;
+        }
+        conn.response = std::move(response);
+        conn.sent = 0;
+        writeClient(client);
+    }
+}
 
-                send(client, response.c_str(), response.size(), 0);
-            }
-            close(client);
+// Sends the head and body parts of the response as they are, with as many
+// writes as the socket needs
+void WebServer::writeClient(int client) {
+    Connection &conn = connections[client];
+    iovec iov[IOV_PER_WRITE];
+    while (conn.sent < conn.response.size()) {
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = conn.response.iovecs(conn.sent, iov, IOV_PER_WRITE);
+        ssize_t bytes = sendmsg(client, &msg, MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watch(client);
+            return;
+        }
+        if (bytes < 0) {
+            closeClient(client);
+            return;
+        }
+        conn.sent += bytes;
+        conn.lastActive = std::chrono::steady_clock::now();
     }
+    conn.response = HttpResponse{};
+    conn.sent = 0;
+    if (!conn.isKeepAlive)
+        closeClient(client);
+    else
+        nextRequest(client);
 }
 
-void WebServer::stop() {
-    running = false;
-    std::cout<< "  ...closing server." << std::endl;
+void WebServer::closeClient(int client) {
+    auto it = connections.find(client);
+    if (it == connections.end())
+        return;
+    if (it->second.isBusy) {
+        // out of epoll, a hung up socket stays ready and the loop would
+        // spin, but the fd is kept until the worker is done, so that it is
+        // not reused meanwhile
+        if (!it->second.isClosed)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, nullptr);
+        it->second.isClosed = true;
+        return;
+    }
+    if (!it->second.isClosed)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, nullptr);
+    close(client);
+    connections.erase(it);
+}
 
-    if (server_fd != -1) {
-        if (shutdown(server_fd, SHUT_RDWR)) { perror("shutdown"); } // shutdown accept, but seems a bit buggy to me
-        if (close(server_fd) != 0) { perror("close"); }
-        server_fd = -1;
+// Closes the connections idle for opts.keepAlive seconds, waiting for a
+// request or for the client to read its response. A thread cannot be
+// stopped, so a worker process with a request running past
+// opts.requestTimeout exits and lets the supervisor start a fresh one.
+void WebServer::checkTimeouts() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<int> idle;
+    for (const auto &[client, conn] : connections) {
+        if (!conn.isBusy) {
+            if (now - conn.lastActive > std::chrono::seconds(opts.keepAlive))
+                idle.push_back(client);
+        } else if (opts.workers > 0 && now - conn.since > std::chrono::seconds(opts.requestTimeout)) {
+            std::cerr << "Worker " << getpid() << ": request stuck for over "
+                      << opts.requestTimeout << "s, restarting" << std::endl;
+            _exit(1);
+        }
     }
+    for (int client : idle)
+        closeClient(client);
 }
 
+// Runs on the worker pool
+HttpResponse WebServer::respond(const HttpRequest &request, bool keepAlive) {
+    const std::string &method = request.method;
+    std::string path = request.path();
+    std::string queryString = request.query();
+
+    {
+        static std::mutex logMutex;
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cout   << "\nREQUEST\n"
+                    // << "method: {" << method << "}\n"
+                    << "path: {" << path << "}\n"
+                    << "queryStrings: {"<< queryString << "}\n"
+                    // << "requst {\n" << request
+                    ;
+        if (!request.body.empty())
+            std::cout << "body: " << request.body.size() << " bytes\n";
+    }
 
-std::string WebServer::readFullFequest(int client) {
-    std::string request;
-    char buffer[4096];
-    bool method_checked = false;
+    HttpResponse response = constructHTMLResponse(Status::NOT_FOUND);
+    if ((method == "GET" || method == "HEAD") && path.starts_with("/graph/")) {
+        response = graphImage(path.substr(7), queryString);
+    } else if (method == "GET" || method == "HEAD") {
+        auto route = get_routes.find(path);
+        if (route != get_routes.end())
+            response = route->second(queryString);
+    } else if (method == "POST") {
+        auto route = post_routes.find(path);
+        if (route != post_routes.end())
+            response = route->second(queryString, request.body);
+    }
+    response.finish(keepAlive, method == "HEAD");
+    return response;
+}
 
-    while (true) {
-        int bytes = read(client, buffer, sizeof(buffer));
-        if (bytes <= 0) break;
-        request.append(buffer, bytes);
+// Supervisor
 
-        if (method_checked == false && bytes > 3) {
-            std::string method = parseMethod(request);
-            if (method != "GET") break;
+static volatile sig_atomic_t supervising = 1;
+
+static void stopSupervising(int) {
+    supervising = 0;
+}
+
+int runServerWorkers(const InputOptions &opts) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<pid_t> pids(opts.workers, -1);
+    std::vector<Clock::time_point> started(opts.workers);
+
+    // the signals wait until the child has its own handlers back
+    sigset_t stopSignals, previous;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+
+    auto spawn = [&](size_t i) {
+        std::cout.flush(); // or the child prints it again
+        sigprocmask(SIG_BLOCK, &stopSignals, &previous);
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+            sigprocmask(SIG_SETMASK, &previous, nullptr);
+            WebServer server(opts);
+            server.start(); // blocks on the server
+            _exit(0);
         }
+        sigprocmask(SIG_SETMASK, &previous, nullptr);
+        if (pid < 0) {
+            perror("fork");
+            return;
+        }
+        pids[i] = pid;
+        started[i] = Clock::now();
+    };
 
-        if (request.find("\r\n\r\n") != std::string::npos)
+    // no SA_RESTART, waitpid returns on the signal
+    struct sigaction sa{};
+    sa.sa_handler = stopSupervising;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    for (size_t i = 0; i < pids.size(); i++)
+        spawn(i);
+
+    while (supervising) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("waitpid");
             break;
+        }
+        auto it = std::find(pids.begin(), pids.end(), pid);
+        if (it == pids.end())
+            continue;
+        const size_t i = it - pids.begin();
+        *it = -1;
+        if (!supervising)
+            break;
+
+        std::cerr << "Worker " << i << " (" << pid << ") ";
+        if (WIFSIGNALED(status))
+            std::cerr << "killed by signal " << WTERMSIG(status);
+        else
+            std::cerr << "exited with status " << WEXITSTATUS(status);
+        std::cerr << ", restarting" << std::endl;
+        // a worker dying right away would otherwise be forked in a loop
+        if (Clock::now() - started[i] < std::chrono::seconds(1))
+            sleep(1);
+        if (supervising)
+            spawn(i);
     }
 
-    return request;
+    std::cout << "  ...stopping workers." << std::endl;
+    for (pid_t pid : pids) {
+        if (pid > 0)
+            kill(pid, SIGTERM);
+    }
+    while (waitpid(-1, nullptr, 0) > 0 || errno == EINTR)
+        ;
+    return 0;
 }
 
 // Utils / helpers
@@ -294,91 +831,76 @@ static std::string urlDecode(const std::string &src) {
     return result;
 }
 
-// #define WITH_GRAPHVIZ
-
-#ifdef WITH_GRAPHVIZ 
-#include <graphviz/gvc.h>
-
-static std::string base64_encode(const std::string &in);
-static void graphvisToFilePNG(const std::string &input, FILE *out);
-static std::string imgHTMLFromRawImg(const std::string &rawImg);
-
-static std::string genGraphImg(const Digraph &digraph) {
-    (void)digraph;
-
-    char* buffer = nullptr;
-    size_t size = 0;
-    
-    // Create memory stream to store resulting png image of the graph
-    FILE* memfile = open_memstream(&buffer, &size);
-    if (!memfile) {
-        perror("open_memstream");
-        return "";
+// Decoded value of the name parameter of the query string
+static std::optional<std::string> queryValue(const std::string &queryParam, const std::string &name) {
+    std::istringstream params(queryParam);
+    std::string param;
+    while (std::getline(params, param, '&')) {
+        if (param.starts_with(name + "="))
+            return urlDecode(param.substr(name.size() + 1));
     }
-
-    const std::string &dotFile = digraph.toDot();
-    graphvisToFilePNG(dotFile, memfile);
-
-    fclose(memfile);
-
-    std::string pngGraph(buffer, size);
-
-    free(buffer);
-
-    return imgHTMLFromRawImg(base64_encode(pngGraph));
-}
-
-static std::string imgHTMLFromRawImg(const std::string &rawImg) {
-    return "<img alt=\"My Image\" src=\"data:image/png;base64," + rawImg + "\">\n";
+    return std::nullopt;
 }
 
-static void graphvisToFilePNG(const std::string &input, FILE *out) {
-    GVC_t *gvc = gvContext();
+#ifdef WITH_GRAPHVIZ
 
-    Agraph_t *g = agmemread(input.c_str());
-    if (!g) {
-        std::cerr << "Error: could not parse graph spec.\n";
-        gvFreeContext(gvc);
-        return;
+// Every byte but the unreserved ones as %XX
+static std::string urlEncode(const std::string &src) {
+    static const char digits[] = "0123456789ABCDEF";
+    std::string result;
+    result.reserve(src.size() * 3);
+    for (unsigned char c : src) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            result.push_back(c);
+        } else {
+            result.push_back('%');
+            result.push_back(digits[c >> 4]);
+            result.push_back(digits[c & 15]);
+        }
     }
-
-    gvLayout(gvc, g, "dot");
-    gvRender(gvc, g, "png", out);
-    gvFreeLayout(gvc, g);
-    agclose(g);
-    gvFreeContext(gvc);
+    return result;
 }
 
-//https://stackoverflow.com/a/34571089/5155484
-
-typedef unsigned char uchar;
-static const std::string b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";//=
-static std::string base64_encode(const std::string &in) {
-    std::string out;
-
-    int val=0, valb=-6;
-    for (uchar c : in) {
-        val = (val<<8) + c;
-        valb += 8;
-        while (valb>=0) {
-            out.push_back(b[(val>>valb)&0x3F]);
-            valb-=6;
-        }
-    }
-    if (valb>-6) out.push_back(b[((val<<8)>>(valb+8))&0x3F]);
-    while (out.size()%4) out.push_back('=');
-    return out;
+// With its DOT when the server that renders it may not have it
+static std::string graphHTML(const std::string &key, const std::string &dot) {
+    const std::string query = dot.empty() ? "" : "?dot=" + urlEncode(dot);
+    return "<img alt=\"Node digraph\" src=\"/graph/" + key + query + "\">\n";
 }
 
 #else
 
-static std::string genGraphImg(const Digraph &digraph) {
-    (void)digraph;
+static std::string graphHTML(const std::string &key, const std::string &dot) {
+    (void)key;
+    (void)dot;
     return "<div style='border: solid; background-color: white; padding: 1em;'>Install graphviz for cool graphs</div>";
 }
 
 #endif
 
+// /graph/<key>, content addressed so cached for good by the browser. An
+// unknown key comes with its DOT from the pages of --workers, rendered here
+// on the pool when it matches the key.
+HttpResponse WebServer::graphImage(const std::string &key, const std::string &queryString) {
+    std::shared_ptr<const RenderedGraph> res = graphs.image(key);
+    if (!res) {
+        const std::optional<std::string> dot = queryValue(queryString, "dot");
+        if (dot && graphs.key(*dot) == key) {
+            graphs.queue(*dot);
+            res = graphs.image(key);
+        }
+    }
+    if (!res)
+        return constructResponse(Status::NOT_FOUND, "text/plain", "Error: Unknown graph, submit the rules again\n");
+
+    HttpResponse response;
+    response.head = statusLine(200) + (graphs.format() == "png"
+        ? "Content-Type: image/png\r\n"
+        : "Content-Type: image/svg+xml; charset=UTF-8\r\n");
+    response.head += "Cache-Control: public, max-age=31536000, immutable\r\n";
+    response.appendShared(std::shared_ptr<const std::string>(res, &res->image));
+    return response;
+}
+
 #define STR(x) #x
 #define XSTR(x) STR(x)
 
@@ -405,8 +927,8 @@ static std::string footer() {
            "</footer>\n";
 }
 
-static std::string favicon() {
-    return {R"DELIM(
+static const std::string &favicon() {
+    static const std::string icon = R"DELIM(
 <svg xmlns="http://www.w3.org/2000/svg" width="138.7" height="163.6">
   <g stroke-linecap="round">
     <path fill="none" stroke="#748873" stroke-width="4" d="m80 29 27 39M80 29l27 39"/>
@@ -462,5 +984,6 @@ static std::string favicon() {
     <path fill="#748873" fill-rule="evenodd" d="m30 108 2-15 11 7-13 8"/>
     <path fill="none" stroke="#748873" stroke-width="4" d="m30 108 2-15m-2 15 2-15m0 0 11 7m-11-7 11 7m0 0-13 8m13-8-13 8m0 0s0 0 0 0m0 0s0 0 0 0"/>
   </g>
-</svg>)DELIM"};
+</svg>)DELIM";
+    return icon;
 }
\ No newline at end of file
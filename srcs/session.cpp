@@ -0,0 +1,69 @@
+#include "result_cache.hpp"
+#include "session.hpp"
+
+
+SessionStore::SessionStore(size_t capacity) : _capacity(capacity) {}
+
+
+// SHA-256 in hex, rules that differ never share a session
+std::string SessionStore::handleOf(const std::string &rules) {
+    return ResultCache::hex(ResultCache::sha256(rules));
+}
+
+
+std::string SessionStore::add(const std::string &rules) {
+    const std::string handle = handleOf(rules);
+    if (get(handle))
+        return handle;
+
+    // compiled outside the lock, other sessions are still served meanwhile
+    auto file = std::make_shared<const RuleFile>(parseRuleFile("session " + handle, rules));
+    const size_t cost = file->kb.memoryEstimate();
+    if (cost > _capacity)
+        throw std::runtime_error("Rule set too large for the session store");
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(handle);
+    if (it != _index.end()) {
+        // uploaded twice at once, the first one in is kept
+        _lru.splice(_lru.begin(), _lru, it->second);
+        return handle;
+    }
+    _lru.push_front({handle, std::move(file), cost});
+    _index[handle] = _lru.begin();
+    _memory += cost;
+    evict();
+    return handle;
+}
+
+
+std::shared_ptr<const RuleFile> SessionStore::get(const std::string &handle) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(handle);
+    if (it == _index.end())
+        return nullptr;
+    _lru.splice(_lru.begin(), _lru, it->second);
+    return it->second->file;
+}
+
+
+size_t SessionStore::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _lru.size();
+}
+
+
+size_t SessionStore::memory() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _memory;
+}
+
+
+// called with the lock held, the front session is never dropped
+void SessionStore::evict() {
+    while (_memory > _capacity && _lru.size() > 1) {
+        _memory -= _lru.back().cost;
+        _index.erase(_lru.back().handle);
+        _lru.pop_back();
+    }
+}
@@ -0,0 +1,248 @@
+#include <cstdio>
+#include <future>
+#include <thread>
+
+#include "stream.hpp"
+#include "thread_pool.hpp"
+
+
+/* ** record parsing ** */
+
+namespace {
+
+const size_t FLUSH_SIZE = 1 << 16;  // bytes buffered before out is written
+const size_t QUEUE_SIZE = 1 << 12;  // records read ahead of the writer
+
+std::string quote(const std::string &s) {
+    std::string res = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"':  res += "\\\""; break;
+            case '\\': res += "\\\\"; break;
+            case '\n': res += "\\n"; break;
+            case '\t': res += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char hex[7];
+                    snprintf(hex, sizeof(hex), "\\u%04x", c);
+                    res += hex;
+                } else
+                    res += c;
+        }
+    }
+    return res + "\"";
+}
+
+// Just enough JSON for one flat object of strings, numbers and literals
+struct JsonReader {
+    const std::string &s;
+    size_t i = 0;
+
+    void skipSpaces() {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n'))
+            i++;
+    }
+
+    void expect(char c) {
+        skipSpaces();
+        if (i >= s.size() || s[i] != c)
+            throw std::runtime_error(std::string("Expected '") + c + "' at column " + std::to_string(i + 1));
+        i++;
+    }
+
+    bool consume(char c) {
+        skipSpaces();
+        if (i < s.size() && s[i] == c) {
+            i++;
+            return true;
+        }
+        return false;
+    }
+
+    std::string string() {
+        expect('"');
+        std::string res;
+        while (i < s.size() && s[i] != '"') {
+            char c = s[i++];
+            if (c != '\\') {
+                res += c;
+                continue;
+            }
+            if (i >= s.size())
+                break;
+            switch (char e = s[i++]) {
+                case 'n': res += '\n'; break;
+                case 't': res += '\t'; break;
+                case 'r': res += '\r'; break;
+                case 'b': res += '\b'; break;
+                case 'f': res += '\f'; break;
+                case 'u': {
+                    if (i + 4 > s.size())
+                        throw std::runtime_error("Bad \\u escape");
+                    unsigned long code = std::stoul(s.substr(i, 4), nullptr, 16);
+                    i += 4;
+                    // only letters matter here, wider code points are kept as '?'
+                    res += code < 0x80 ? char(code) : '?';
+                    break;
+                }
+                default: res += e;
+            }
+        }
+        expect('"');
+        return res;
+    }
+
+    // A scalar value as raw JSON, strings are unescaped in value
+    std::string scalar(std::string &value) {
+        skipSpaces();
+        if (i < s.size() && s[i] == '"') {
+            value = string();
+            return quote(value);
+        }
+        size_t start = i;
+        while (i < s.size() && s[i] != ',' && s[i] != '}' && s[i] != ' ' && s[i] != '\t')
+            i++;
+        std::string raw = s.substr(start, i - start);
+        if (raw == "true" || raw == "false" || raw == "null") {
+            value = raw;
+            return raw;
+        }
+        if (raw.empty() || raw.find_first_not_of("-+.0123456789eE") != std::string::npos)
+            throw std::runtime_error("Unsupported value at column " + std::to_string(start + 1));
+        value = raw;
+        return raw;
+    }
+};
+
+const char *stateName(const KnowledgeBase::Result &res, size_t i) {
+    if (res.errors[i])
+        return "Error";
+    switch (res.states[i]) {
+        case Fact::State::True:  return "True";
+        case Fact::State::False: return "False";
+        default:                 return "Undetermined";
+    }
+}
+
+} // namespace
+
+
+StreamRecord parseStreamRecord(const RuleFile &file, const std::string &line) {
+    StreamRecord record{"null", file.facts, file.queries, ""};
+    try {
+        JsonReader json{line};
+        json.expect('{');
+        bool first = true;
+        while (!json.consume('}')) {
+            if (!first)
+                json.expect(',');
+            first = false;
+            std::string key = json.string();
+            json.expect(':');
+            std::string value;
+            std::string raw = json.scalar(value);
+            if (key == "id")
+                record.id = raw;
+            else if (key == "facts")
+                record.facts = KnowledgeBase::factMask(value);
+            else if (key == "queries") {
+                // Query has const members, the vector cannot be assigned
+                std::vector<Query> queries = KnowledgeBase::queryList(value);
+                record.queries.clear();
+                for (const auto &q : queries)
+                    record.queries.push_back(q);
+            }
+        }
+        json.skipSpaces();
+        if (json.i != line.size())
+            throw std::runtime_error("Trailing characters at column " + std::to_string(json.i + 1));
+        if (record.queries.empty())
+            throw std::runtime_error("No queries");
+    } catch (const std::exception &e) {
+        record.error = e.what();
+    }
+    return record;
+}
+
+
+std::string streamError(const std::string &id, const std::string &message) {
+    return "{\"id\":" + id + ",\"error\":" + quote(message) + "}";
+}
+
+
+std::string answerStreamRecord(const RuleFile &file, const StreamRecord &record) {
+    if (!record.error.empty())
+        return streamError(record.id, record.error);
+    std::string res = "{\"id\":" + record.id;
+    try {
+        KnowledgeBase::Result solved = file.kb.evaluate(record.facts, record.queries);
+        res += ",\"results\":{";
+        for (size_t i = 0; i < record.queries.size(); i++) {
+            res += (i ? ",\"" : "\"");
+            res += record.queries[i].label;
+            res += "\":\"";
+            res += stateName(solved, i);
+            res += "\"";
+        }
+        return res + "}}";
+    } catch (const std::exception &e) {
+        return streamError(record.id, e.what());
+    }
+}
+
+
+std::string handleStreamRecord(const RuleFile &file, const std::string &line) {
+    return answerStreamRecord(file, parseStreamRecord(file, line));
+}
+
+
+/* ** pipeline ** */
+
+int runStream(const InputOptions &opts, std::istream &in, std::ostream &out) {
+    std::optional<RuleFile> loaded;
+    try {
+        loaded.emplace(loadRuleFile(opts.file));
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    const RuleFile &file = *loaded;
+
+    ThreadPool solvers(opts.jobs);
+    BoundedQueue<std::future<std::string>> answers(QUEUE_SIZE);
+
+    // writes answers in input order, out is written when the buffer is full
+    // or before waiting on an answer that is not ready yet
+    std::thread writer([&] {
+        std::string buffer;
+        auto flush = [&] {
+            out.write(buffer.data(), buffer.size());
+            out.flush();
+            buffer.clear();
+        };
+        while (auto answer = answers.pop()) {
+            if (!buffer.empty()
+                    && answer->wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                flush();
+            buffer += answer->get();
+            buffer += '\n';
+            if (buffer.size() >= FLUSH_SIZE)
+                flush();
+        }
+        if (!buffer.empty())
+            flush();
+    });
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        StreamRecord record = parseStreamRecord(file, line);
+        answers.push(solvers.submit([&file, record = std::move(record)] {
+            return answerStreamRecord(file, record);
+        }));
+    }
+    answers.close();
+    writer.join();
+    return 0;
+}
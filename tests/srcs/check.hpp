@@ -0,0 +1,42 @@
+#ifndef CHECK_HPP
+# define CHECK_HPP
+
+# include <iostream>
+# include <string>
+
+# define GREEN   "\033[32m"
+# define RED     "\033[31m"
+# define RESET   "\033[0m"
+
+
+// Each check prints its description followed by OK or KO, checkSummary the
+// count of OK's at the end
+inline int test_count = 0;
+inline int ko_count = 0;
+
+inline void check(const std::string &description, bool ok, const std::string &details = "") {
+    test_count++;
+    if (ok) {
+        std::cout << description << " " << GREEN << "OK" << RESET << "\n";
+        return;
+    }
+    ko_count++;
+    std::cout << description << " " << RED << "KO" << RESET << "\n" << details;
+}
+
+inline void check(const std::string &description, const std::string &got, const std::string &expected) {
+    check(description, got == expected,
+        "  got:      " + got + "\n  expected: " + expected + "\n");
+}
+
+// what() and literals, which would otherwise convert to bool
+inline void check(const std::string &description, const char *got, const std::string &expected) {
+    check(description, std::string(got), expected);
+}
+
+inline void checkSummary() {
+    std::cout << "\nOK's : " << test_count - ko_count << " / " << test_count << "\n";
+}
+
+
+#endif /* CHECK_HPP */
@@ -12,6 +12,7 @@ void testExprContaines();
 void testExprReplacment();
 void testDigraph();
 void testDigraphViz();
+void testDigraphScc();
 
 void testSocratiesRuleSet();
 
@@ -28,6 +29,54 @@ int main() {
     testExprReplacment();
     testDigraph();
     testDigraphViz();
+    testDigraphScc();
+}
+
+
+void testDigraphScc() {
+    cout << "Digraph strongly connected components" << endl;
+
+    Digraph digraph;
+
+    // A => B, B => C, C => A is a cycle, D => E and C => F hang off it
+    digraph.addRule(Rule(Imply(Var('A'), Var('B'))));
+    digraph.addRule(Rule(Imply(Var('B'), Var('C'))));
+    digraph.addRule(Rule(Imply(Var('C'), Var('A'))));
+    digraph.addRule(Rule(Imply(Var('D'), Var('E'))));
+    digraph.addRule(Rule(Imply(Var('C'), Var('F'))));
+    // G and H are concluded together, they depend on each other
+    digraph.addRule(Rule(Imply(Var('F'), Or(Var('G'), Var('H')))));
+    digraph.freeze();
+
+    struct Test {
+        char fact;
+        size_t component_size;
+        bool isCyclic;
+    };
+    std::vector<Test> tests = {
+        {'A', 3, true}, {'B', 3, true}, {'C', 3, true},
+        {'D', 1, false}, {'E', 1, false}, {'F', 1, false},
+        {'G', 2, true}, {'H', 2, true},
+    };
+    for (const auto &t : tests) {
+        const auto &scc = digraph.sccs[digraph.scc_of.at(t.fact)];
+        if (scc.facts.size() == t.component_size && scc.isCyclic == t.isCyclic) {
+            cout << "OK" << endl;
+        } else {
+            cerr << "KO: " << t.fact << " in a component of " << scc.facts.size()
+                 << " (expected " << t.component_size << ")" << endl;
+        }
+    }
+
+    // every component comes after the ones it depends on
+    auto before = [&](char dependency, char fact) {
+        return digraph.scc_of.at(dependency) < digraph.scc_of.at(fact);
+    };
+    if (before('D', 'E') && before('A', 'F') && before('F', 'G')) {
+        cout << "OK" << endl;
+    } else {
+        cerr << "KO: components are not in dependency order" << endl;
+    }
 }
 
 
@@ -0,0 +1,67 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "batch.hpp"
+#include "check.hpp"
+
+std::string readAll(const std::string &path) {
+    std::ifstream file(path);
+    std::ostringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+int main() {
+    std::cout << "Testing batch mode\n";
+
+    // same output as one process per file, see tester.sh
+    InputOptions opts;
+    for (const auto &file : listBatchFiles("shouldWork")) {
+        std::string expected = "shouldWork/expected/"
+            + std::filesystem::path(file).stem().string() + ".out";
+        BatchResult res = solveBatchFile(opts, file);
+        check(file, std::to_string(res.status) + "\n" + res.output, "0\n" + readAll(expected));
+    }
+    for (const auto &file : listBatchFiles("shouldNotWork"))
+        check(file, std::to_string(solveBatchFile(opts, file).status), "1");
+
+    const std::string dir = "/tmp/test_batch";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::ofstream(dir + "/b.txt") << "A => B\n=A\n?B\n";
+    std::ofstream(dir + "/a.txt") << "A => \n=A\n?B\n";
+    std::ofstream(dir + "/list") << "# comment\n" << dir << "/b.txt\n\n  " << dir << "/missing.txt\n";
+
+    check("List files", [&] {
+        std::string res;
+        for (const auto &f : listBatchFiles(dir))
+            res += f + "\n";
+        return res;
+    }(), dir + "/a.txt\n" + dir + "/b.txt\n" + dir + "/list\n");
+
+    for (size_t jobs : {1, 4}) {
+        std::ostringstream out;
+        opts.jobs = jobs;
+        opts.batch = dir + "/list";
+        int ret = runBatch(opts, out);
+        check("List, " + std::to_string(jobs) + " jobs", std::to_string(ret) + "\n" + out.str(),
+            "1\n==> " + dir + "/b.txt <== 0\nB is True\n"
+            "==> " + dir + "/missing.txt <== 1\nError: Cannot open file \"" + dir + "/missing.txt\"\n");
+    }
+
+    // the window of pending files is smaller than the batch
+    std::string list, expected;
+    for (int i = 0; i < 600; i++) {
+        list += dir + "/b.txt\n";
+        expected += "==> " + dir + "/b.txt <== 0\nB is True\n";
+    }
+    std::ofstream(dir + "/long") << list;
+    opts.batch = dir + "/long";
+    opts.jobs = 2;
+    std::ostringstream out;
+    int ret = runBatch(opts, out);
+    check("Long batch keeps order", std::to_string(ret) + "\n" + out.str(), "0\n" + expected);
+
+    checkSummary();
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "expert-system.h"
+#include "check.hpp"
+
+int main() {
+    std::cout << "Testing C interface\n";
+    char err[256] = "";
+
+    es_kb *kb = es_kb_load_text("A + B => C\nC | D => E\nA => F ^ G\nF => G\nH => I\nH => !I\n", err, sizeof err);
+    check("Load from text", kb != nullptr);
+
+    es_state out[4];
+    int n = es_kb_evaluate(kb, 0b11, "CEG", out, 4, err, sizeof err);
+    check("Evaluate", n == 3 && out[0] == ES_TRUE && out[1] == ES_TRUE && out[2] == ES_TRUE);
+    n = es_kb_evaluate(kb, 0b01, "CEG", out, 4, err, sizeof err);
+    check("Evaluate closed world", n == 3 && out[0] == ES_FALSE && out[1] == ES_FALSE && out[2] == ES_TRUE);
+    n = es_kb_evaluate(kb, 1u << ('H' - 'A'), "I", out, 4, err, sizeof err);
+    check("Contradiction is an error state", n == 1 && out[0] == ES_ERROR);
+
+    check("Output buffer too small", es_kb_evaluate(kb, 0, "CEG", out, 2, err, sizeof err) == -1);
+    check("Invalid query", es_kb_evaluate(kb, 0, "C?", out, 4, err, sizeof err) == -1
+        && std::string(err) == "Invalid query: ?");
+
+    std::vector<uint8_t> bytes(es_kb_compile(kb, nullptr, 0));
+    check("Compile", es_kb_compile(kb, bytes.data(), bytes.size()) == bytes.size() && !bytes.empty());
+    es_kb *compiled = es_kb_load_compiled(bytes.data(), bytes.size(), err, sizeof err);
+    check("Load compiled", compiled != nullptr);
+
+    const uint32_t facts[4] = {0b11, 0b01, 0b1000, 0};
+    es_state batch[8], single[2];
+    n = es_kb_evaluate_batch(compiled, facts, 4, "CE", batch, 8, err, sizeof err);
+    bool same = n == 2;
+    for (int i = 0; same && i < 4; i++) {
+        es_kb_evaluate(kb, facts[i], "CE", single, 2, err, sizeof err);
+        same = batch[2 * i] == single[0] && batch[2 * i + 1] == single[1];
+    }
+    check("Batch on compiled rules matches text rules", same);
+    check("Batch size wrapping around", es_kb_evaluate_batch(kb, facts, SIZE_MAX / 2 + 1, "CE", batch, 8,
+        err, sizeof err) == -1 && std::string(err) == "Output buffer too small");
+
+    bytes.pop_back();
+    check("Truncated compiled rules", es_kb_load_compiled(bytes.data(), bytes.size(), err, sizeof err) == nullptr);
+    check("Syntax error", es_kb_load_text("A => (B\n", err, sizeof err) == nullptr && err[0] != '\0');
+
+    es_kb_free(compiled);
+    es_kb_free(kb);
+
+    checkSummary();
+}
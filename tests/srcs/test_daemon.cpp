@@ -0,0 +1,157 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "daemon.hpp"
+#include "result_cache.hpp"
+#include "check.hpp"
+
+using namespace daemon_protocol;
+
+// Responses are binary, compared as their bytes in hex
+void checkBytes(const std::string &description, const std::string &got, const std::string &expected) {
+    check(description, ResultCache::hex(got), ResultCache::hex(expected));
+}
+
+std::string evaluateRequest(uint16_t kb, uint32_t set, uint32_t clear, const std::string &queries) {
+    std::string req(1, EVALUATE);
+    for (int i = 0; i < 2; i++) req.push_back(char(kb >> (8 * i)));
+    for (int i = 0; i < 4; i++) req.push_back(char(set >> (8 * i)));
+    for (int i = 0; i < 4; i++) req.push_back(char(clear >> (8 * i)));
+    req.push_back(char(queries.size()));
+    return req + queries;
+}
+
+std::string states(std::initializer_list<int> s) {
+    std::string res = {char(OK), char(s.size())};
+    for (int v : s)
+        res.push_back(char(v));
+    return res;
+}
+
+// The error bindDaemonSocket throws, or "bound"
+std::string bindResult(const std::string &path, int *fd = nullptr) {
+    try {
+        int bound = bindDaemonSocket(path);
+        if (fd)
+            *fd = bound;
+        else
+            close(bound);
+        return "bound";
+    } catch (const std::exception &e) {
+        return e.what();
+    }
+}
+
+void testSocketPath() {
+    const std::string path = "/tmp/test_daemon.sock";
+    unlink(path.c_str());
+
+    std::ofstream(path) << "not a socket\n";
+    check("Regular file kept", bindResult(path), path + " exists and is not a socket");
+    check("Regular file still there", std::to_string(access(path.c_str(), F_OK)), "0");
+    unlink(path.c_str());
+
+    int live = -1;
+    check("Fresh path", bindResult(path, &live), "bound");
+    check("Live daemon kept", bindResult(path), "a daemon already listens on " + path);
+    close(live);
+    check("Stale socket replaced", bindResult(path), "bound");
+    unlink(path.c_str());
+}
+
+int connectTo(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        perror("connect");
+    return fd;
+}
+
+// One framed message, "closed" once the daemon closed the connection and
+// "timeout" when nothing comes
+std::string readFrame(int fd) {
+    std::string res;
+    uint32_t size = 0;
+    char c;
+    while (res.size() < 4 + size) {
+        ssize_t n = recv(fd, &c, 1, 0);
+        if (n == 0)
+            return "closed";
+        if (n < 0)
+            return "timeout";
+        res.push_back(c);
+        if (res.size() == 4)
+            for (int i = 0; i < 4; i++)
+                size |= uint32_t(uint8_t(res[i])) << (8 * i);
+    }
+    return res.substr(4);
+}
+
+std::string exchange(int fd, const std::string &request) {
+    std::string frame;
+    for (int i = 0; i < 4; i++)
+        frame.push_back(char(request.size() >> (8 * i)));
+    frame += request;
+    send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+    return readFrame(fd);
+}
+
+// Every thread held by an idle client, the next client is answered once
+// they are timed out
+void testIdleConnections(const std::vector<RuleFile> &kbs) {
+    const std::string path = "/tmp/test_daemon_idle.sock";
+    unlink(path.c_str());
+    const int server_fd = bindDaemonSocket(path);
+    std::thread([server_fd, &kbs] { serveDaemon(server_fd, kbs, 1); }).detach();
+
+    std::vector<int> idle;
+    for (size_t i = 0; i < MAX_CONNECTIONS; i++)
+        idle.push_back(connectTo(path));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    const int fd = connectTo(path);
+    checkBytes("Answered past idle clients", exchange(fd, std::string(1, LIST)),
+        std::string{char(OK), 1, 0, char(kbs[0].name.size())} + kbs[0].name);
+    check("Idle client closed", readFrame(idle[0]), "closed");
+    for (int client : idle)
+        close(client);
+    close(fd);
+    unlink(path.c_str());
+}
+
+int main() {
+    std::cout << "Testing daemon protocol\n";
+
+    const std::string path = "/tmp/test_daemon_rules.txt";
+    std::ofstream(path) << "A + B => C\nC => D\nH => I\nH => !I\n=A\n?CD\n";
+    std::vector<RuleFile> kbs;
+    kbs.push_back(loadRuleFile(path));
+
+    checkBytes("File queries and facts", handleDaemonRequest(kbs, evaluateRequest(0, 0, 0, "")), states({0, 0}));
+    checkBytes("Set a fact", handleDaemonRequest(kbs, evaluateRequest(0, 0b10, 0, "")), states({1, 1}));
+    checkBytes("Clear a file fact", handleDaemonRequest(kbs, evaluateRequest(0, 0b10, 0b1, "CB")), states({0, 1}));
+    checkBytes("Query in error", handleDaemonRequest(kbs, evaluateRequest(0, 1u << 7, 0, "I")), states({3}));
+
+    checkBytes("List", handleDaemonRequest(kbs, std::string(1, LIST)),
+        std::string{char(OK), 1, 0, char(path.size())} + path);
+
+    checkBytes("Unknown knowledge base", handleDaemonRequest(kbs, evaluateRequest(3, 0, 0, "")),
+        std::string(1, ERROR) + "Unknown knowledge base 3");
+    checkBytes("Truncated request", handleDaemonRequest(kbs, evaluateRequest(0, 0, 0, "").substr(0, 5)),
+        std::string(1, ERROR) + "Request too short");
+    checkBytes("Invalid query", handleDaemonRequest(kbs, evaluateRequest(0, 0, 0, "c")),
+        std::string(1, ERROR) + "Invalid query: c");
+    checkBytes("Unknown opcode", handleDaemonRequest(kbs, "\x7f"), std::string(1, ERROR) + "Unknown opcode");
+
+    testSocketPath();
+    testIdleConnections(kbs);
+
+    checkSummary();
+}
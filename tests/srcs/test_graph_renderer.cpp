@@ -0,0 +1,58 @@
+#include <atomic>
+#include <iostream>
+
+#include "graph_renderer.hpp"
+#include "check.hpp"
+
+static std::atomic<int> renders{0};
+
+// Stands in for graphviz, slow enough for a request to come in meanwhile
+std::string fakeRender(const std::string &dot, const std::string &format) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    renders++;
+    return format + ":" + dot;
+}
+
+// "404" like the server for an unknown key
+std::string image(GraphRenderer &graphs, const std::string &key) {
+    auto res = graphs.image(key);
+    return res ? res->image : "404";
+}
+
+int main() {
+    std::cout << "Testing graph renderer\n";
+
+    check("Key is the SHA-256 of format and DOT", GraphRenderer::keyOf("digraph {}", "svg"),
+        "bd6b4b51f737a8f4480f6f4cf7ecf393e10b0be2375ff14535e0070b1d2ca6f6");
+    check("Format changes the key",
+        std::to_string(GraphRenderer::keyOf("digraph {}", "png") != GraphRenderer::keyOf("digraph {}", "svg")), "1");
+
+    const std::string a = "digraph { A -> B }";
+    const std::string b = "digraph { C -> D }";
+    const std::string key_a = GraphRenderer::keyOf(a, "svg");
+    const std::string key_b = GraphRenderer::keyOf(b, "svg");
+    // room for one image
+    GraphRenderer graphs(key_a.size() + fakeRender(a, "svg").size(), "svg", fakeRender);
+    renders = 0;
+
+    check("Unknown key", image(graphs, key_a), "404");
+    check("Queue gives the key", graphs.queue(a), key_a);
+    check("Asked while pending", image(graphs, key_a), "svg:" + a);
+    graphs.queue(a);
+    graphs.wait();
+    check("Rendered once", std::to_string(renders), "1");
+    check("Cached", image(graphs, key_a), "svg:" + a);
+
+    graphs.queue(b);
+    graphs.wait();
+    check("Rendered apart", std::to_string(renders), "2");
+    check("Evicted key is unknown", image(graphs, key_a), "404");
+    check("Newest kept", image(graphs, key_b), "svg:" + b);
+
+    graphs.queue(a);
+    check("Queued again after eviction", image(graphs, key_a), "svg:" + a);
+    graphs.wait();
+    check("Rendered again once", std::to_string(renders), "3");
+
+    checkSummary();
+}
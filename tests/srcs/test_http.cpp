@@ -0,0 +1,105 @@
+#include <iostream>
+
+#include "http.hpp"
+#include "check.hpp"
+
+// Every request the input holds, fed step bytes at a time, as
+// "METHOD target body|" and "error N" at the first error
+std::string parse(const std::string &input, size_t step, size_t maxBody = 1 << 20) {
+    HttpParser parser(maxBody);
+    std::string res;
+    for (size_t i = 0; i < input.size() && !parser.hasError(); i += step) {
+        parser.feed(input.data() + i, std::min(step, input.size() - i));
+        while (parser.hasRequest()) {
+            HttpRequest req = parser.take();
+            res += req.method + " " + req.target + " " + req.body + "|";
+        }
+    }
+    if (parser.hasError())
+        res += "error " + std::to_string(parser.errorStatus());
+    return res;
+}
+
+void checkAllSteps(const std::string &description, const std::string &input, const std::string &expected) {
+    for (size_t step : {size_t(1), size_t(3), size_t(7), input.size()})
+        check(description + ", " + std::to_string(step) + " bytes at a time", parse(input, step), expected);
+}
+
+int main() {
+    std::cout << "Testing the HTTP parser\n";
+
+    checkAllSteps("GET", "GET /evaluate?rules=A HTTP/1.1\r\nHost: x\r\n\r\n", "GET /evaluate?rules=A |");
+    checkAllSteps("Content-Length", "POST /api/evaluate HTTP/1.1\r\ncontent-length: 7\r\n\r\nA => B\n",
+        "POST /api/evaluate A => B\n|");
+    checkAllSteps("Chunked", "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "3;ext=1\r\nA =\r\n4\r\n> B\n\r\n0\r\nTrailer: x\r\n\r\n", "POST /a A => B\n|");
+    checkAllSteps("Pipelined", "GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 2\r\n\r\nhiGET /c HTTP/1.0\n\n",
+        "GET /a |POST /b hi|GET /c |");
+
+    check("Bad request line", parse("GET\r\n\r\n", 1), "error 400");
+    check("Bad version", parse("GET / HTTP/2.0\r\n\r\n", 1), "error 505");
+    check("Bad header", parse("GET / HTTP/1.1\r\nNo colon\r\n\r\n", 4), "error 400");
+    check("Bad Content-Length", parse("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", 4), "error 400");
+    check("Two lengths", parse("POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n", 4),
+        "error 400");
+    check("Unknown encoding", parse("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", 4), "error 501");
+    check("Body too large", parse("POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\n", 4, 10), "error 413");
+    check("Chunks too large", parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nabcdef\r\n5\r\n", 4, 10),
+        "error 413");
+    check("Chunk longer than its size", parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\nab\r\n", 4),
+        "error 400");
+    check("Headers too large", parse("GET /" + std::string(HttpParser::MAX_HEADERS, 'a'), 1 << 16), "error 431");
+
+    HttpParser parser;
+    std::string expect = "POST / HTTP/1.1\r\nExpect: 100-Continue\r\nContent-Length: 1\r\n\r\n";
+    parser.feed(expect.data(), expect.size());
+    bool first = parser.takeContinue();
+    bool second = parser.takeContinue();
+    check("Expect 100-continue, once", std::to_string(first) + std::to_string(second), "10");
+
+    HttpRequest req;
+    req.target = "/evaluate?rules=A";
+    req.version = "HTTP/1.1";
+    check("Path and query", req.path() + " " + req.query(), "/evaluate rules=A");
+    check("HTTP/1.1 keeps alive", std::to_string(req.isKeepAlive()), "1");
+    req.headers.emplace_back("connection", "Close");
+    check("Connection: close", std::to_string(req.isKeepAlive()), "0");
+    req.version = "HTTP/1.0";
+    req.headers = {{"Connection", "keep-alive"}};
+    check("HTTP/1.0 keep-alive", std::to_string(req.isKeepAlive()), "1");
+
+    HttpResponse res;
+    res.head = "HTTP/1.1 200 OK\r\n";
+    res.appendStatic("<p>");
+    res.append(std::string(20, 'x'));
+    HttpResponse more;
+    more.append("y");
+    more.appendStatic("</p>");
+    res.append(std::move(more));
+    res.finish(true);
+    const std::string whole = "HTTP/1.1 200 OK\r\nContent-Length: 28\r\nConnection: keep-alive\r\n\r\n<p>"
+        + std::string(20, 'x') + "y</p>";
+    check("Response parts", res.str(), whole);
+    // what writev would send after each partial write
+    bool isResumed = true;
+    for (size_t sent = 0; sent <= whole.size(); sent++) {
+        iovec iov[2];
+        std::string rest;
+        for (size_t from = sent; from < whole.size(); ) {
+            int count = res.iovecs(from, iov, 2);
+            for (int i = 0; i < count; i++) {
+                rest.append(static_cast<char *>(iov[i].iov_base), iov[i].iov_len);
+                from += iov[i].iov_len;
+            }
+        }
+        isResumed = isResumed && rest == whole.substr(sent);
+    }
+    check("Response resumed after partial writes", std::to_string(isResumed), "1");
+    HttpResponse head;
+    head.head = "HTTP/1.1 200 OK\r\n";
+    head.append("body");
+    head.finish(false, true);
+    check("HEAD response", head.str(), "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nConnection: close\r\n\r\n");
+
+    checkSummary();
+}
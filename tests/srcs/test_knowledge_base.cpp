@@ -0,0 +1,142 @@
+#include <thread>
+
+#include "expert-system.hpp"
+#include "parser.hpp"
+#include "knowledge_base.hpp"
+#include "check.hpp"
+
+using std::cout;
+using std::endl;
+
+// What the CLI concludes for the rules with a "=facts" and "?queries" line
+std::string solveFile(const std::string &rules, const std::string &facts, const std::string &queries) {
+    auto [r, f, q] = parseTokens(tokenizer(rules + "\n=" + facts + "\n?" + queries + "\n"));
+    Digraph digraph = makeDigraph(f, r, q);
+    digraph.applyWorldAssumption(false);
+    return digraph.solveEverythingNoThrow(q).conlusion;
+}
+
+void testAgainstFile(const std::string &rules, const std::vector<std::string> &factSets, const std::string &queries) {
+    KnowledgeBase kb = KnowledgeBase::fromText(rules);
+    for (const auto &facts : factSets) {
+        auto res = kb.evaluate(facts, queries);
+        auto expected = solveFile(rules, facts, queries);
+        check("=" + facts + " ?" + queries, res.conclusion == expected,
+            "got\n" + res.conclusion + "expected\n" + expected);
+    }
+}
+
+void testConcurrentEvaluate() {
+    const std::string rules = "A + B => C\nC | D => E\n!E => F\nF ^ A => G\nG <=> H\n";
+    KnowledgeBase kb = KnowledgeBase::fromText(rules);
+
+    std::vector<std::string> expected(64);
+    for (uint32_t m = 0; m < 64; m++)
+        expected[m] = kb.evaluate(m, KnowledgeBase::queryList("CEFGH")).conclusion;
+
+    std::atomic<int> mismatches = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 500; i++) {
+                uint32_t m = (i * 7 + t) % 64;
+                if (kb.evaluate(m, KnowledgeBase::queryList("CEFGH")).conclusion != expected[m])
+                    mismatches++;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    check("Concurrent evaluations", mismatches == 0);
+}
+
+// The second pass only uses the expressions the first one compiled, facts
+// that only differ outside the cone of a query share them
+void testCompiledOnce() {
+    const std::string rules = "A + B => C\nC | D => E\n!E => F\nF ^ A => G\n";
+    KnowledgeBase kb = KnowledgeBase::fromText(rules);
+    const std::string letters = "ABDF";
+    bool ok = true;
+    size_t compiled[2];
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t m = 0; m < 16; m++) {
+            std::string facts;
+            for (int b = 0; b < 4; b++) {
+                if (m & (1u << b))
+                    facts += letters[b];
+            }
+            ok = ok && kb.evaluate(facts, "CEG").conclusion == solveFile(rules, facts, "CEG");
+        }
+        compiled[pass] = kb.compiledCount();
+    }
+    check("Compiled expressions answer as the file does", ok);
+    // 16 fact sets times 3 queries, C only reads A and B
+    check("Compiled expressions shared across fact sets", compiled[0] > 0 && compiled[0] < 16 * 3,
+        "  " + std::to_string(compiled[0]) + " compiled\n");
+    check("Compiled expressions reused on the second pass", compiled[1] == compiled[0],
+        "  " + std::to_string(compiled[1]) + " after " + std::to_string(compiled[0]) + "\n");
+}
+
+void testBatch() {
+    KnowledgeBase kb = KnowledgeBase::fromText("A + B => C\nC | D => E\n");
+    std::vector<uint32_t> facts;
+    for (uint32_t m = 0; m < 16; m++)
+        facts.push_back(m);
+    auto queries = KnowledgeBase::queryList("CE");
+    auto res = kb.evaluateBatch(facts, queries);
+    bool ok = res.size() == facts.size();
+    for (size_t i = 0; ok && i < facts.size(); i++)
+        ok = res[i].conclusion == kb.evaluate(facts[i], queries).conclusion;
+    check("Batch matches single evaluations", ok);
+}
+
+void testSerialize() {
+    const std::string rules = "A + B => C\nC | !D => E ^ F\nE <=> G\n";
+    KnowledgeBase kb = KnowledgeBase::fromText(rules);
+    auto bytes = kb.serialize();
+    KnowledgeBase loaded = KnowledgeBase::fromBytes(bytes.data(), bytes.size());
+    bool ok = loaded.serialize() == bytes;
+    for (uint32_t m = 0; ok && m < 16; m++)
+        ok = loaded.evaluate(m, KnowledgeBase::queryList("CEFG")).conclusion
+            == kb.evaluate(m, KnowledgeBase::queryList("CEFG")).conclusion;
+    check("Serialized rules evaluate the same", ok);
+
+    bool thrown = false;
+    bytes[9] = 0x42;
+    try { KnowledgeBase::fromBytes(bytes.data(), bytes.size()); } catch (std::exception &) { thrown = true; }
+    check("Invalid opcode throws", thrown);
+}
+
+void testErrors() {
+    bool thrown = false;
+    try { KnowledgeBase::fromText("A => B\n=A\n"); } catch (std::exception &) { thrown = true; }
+    check("Facts line in rules throws", thrown);
+
+    thrown = false;
+    KnowledgeBase kb = KnowledgeBase::fromText("A => B\n");
+    try { kb.evaluate("a", "B"); } catch (std::exception &) { thrown = true; }
+    check("Invalid fact throws", thrown);
+
+    auto res = kb.evaluate("", "Z");
+    check("Fact outside the rules is False", res.states == std::vector{Fact::State::False});
+
+    RuleFile file = parseRuleFile("no queries", "A => B\n=A\n");
+    check("Rule file without queries", file.queries.empty() && file.facts == 1
+        && file.kb.evaluate(file.facts, KnowledgeBase::queryList("B")).states == std::vector{Fact::State::True});
+}
+
+int main() {
+    cout << "Testing knowledge base" << endl;
+
+    testAgainstFile("A => B\nB => C\n", {"", "A", "B", "AB"}, "ABC");
+    testAgainstFile("A + B => C\nC | D => E | F\n!E => G\nG <=> H\n", {"", "AB", "D", "ABD", "H"}, "CEFGH");
+    testAgainstFile("A => B\nB => C\nC => A\nD ^ A => !E\n", {"", "A", "D", "AD"}, "ABCE");
+    testConcurrentEvaluate();
+    testCompiledOnce();
+    testBatch();
+    testSerialize();
+    testErrors();
+
+    checkSummary();
+    return 0;
+}
@@ -46,6 +46,58 @@ void test(const std::string& input, bool should_pass = true) {
     }
 }
 
+// Only the rules in the backward cone of the queries should be parsed
+void testQueryCone(const std::string& input, size_t expected_rules) {
+    ++test_count;
+    try {
+        auto [rules, facts, queries] = parseTokensQueryCone(tokenizer(input));
+        if (rules.size() == expected_rules) {
+            std::cout << "Cone: " << rules.size() << " rules " << GREEN << "OK" << RESET << "\n";
+            return;
+        }
+        ++ko_count;
+        std::cout << "Cone: " << RED << "KO" << RESET << "\n";
+        std::cout << "  Expected: " << expected_rules << " rules\n";
+        std::cout << "  Got:      " << rules.size() << " rules\n";
+        for (const auto &r : rules)
+            std::cout << "    " << r << "\n";
+    } catch (std::exception &e) {
+        ++ko_count;
+        std::cout << "Cone: " << RED << "KO" << RESET << "\n";
+        std::cout << "  Exception: " << e.what() << "\n";
+    }
+}
+
+void testScenarios(const std::string& input, size_t expected_rules, size_t expected_scenarios) {
+    ++test_count;
+    try {
+        auto [rules, scenarios] = parseTokensScenarios(tokenizer(input));
+        if (rules.size() == expected_rules && scenarios.size() == expected_scenarios) {
+            std::cout << "Scenarios: " << scenarios.size() << " " << GREEN << "OK" << RESET << "\n";
+            return;
+        }
+        ++ko_count;
+        std::cout << "Scenarios: " << RED << "KO" << RESET << "\n";
+        std::cout << "  Expected: " << expected_rules << " rules " << expected_scenarios << " scenarios\n";
+        std::cout << "  Got:      " << rules.size() << " rules " << scenarios.size() << " scenarios\n";
+    } catch (std::exception &e) {
+        ++ko_count;
+        std::cout << "Scenarios: " << RED << "KO" << RESET << "\n";
+        std::cout << "  Exception: " << e.what() << "\n";
+    }
+}
+
+void testScenariosThrow(const std::string& input) {
+    ++test_count;
+    try {
+        parseTokensScenarios(tokenizer(input));
+        ++ko_count;
+        std::cout << "Scenarios should throw: " << RED << "KO" << RESET << "\n";
+    } catch (std::exception &e) {
+        std::cout << "Scenarios throw: " << e.what() << " " << GREEN << "OK" << RESET << "\n";
+    }
+}
+
 int main() {
     std::cout << "Parsing tests\n";
 
@@ -64,5 +116,30 @@ int main() {
     test("(A|!(H+(!J^L)))");
     test("(A|!(H+(J^!L)))");
 
+
+    std::cout << "\nQuery cone tests\n";
+
+    testQueryCone("A=>B\nC=>D\n=A\n?B", 1);
+    testQueryCone("A=>B\nB=>C\nC=>D\nX=>Y\n=A\n?D", 3);
+    // B is concluded alongside C, so the rules concluding B are needed too
+    testQueryCone("A=>B|C\nD=>B\nE=>F\n=A\n?C", 2);
+    // both sides of an iff are conclusions
+    testQueryCone("A<=>B\nC=>A\nE=>F\n=C\n?B", 2);
+    // rules outside the cone are never parsed
+    testQueryCone("A=>B\nX | () => Y\n=A\n?B", 1);
+    testQueryCone("A=>B\n=A\n?Z", 0);
+
+
+    std::cout << "\nScenario tests\n";
+
+    testScenarios("A=>B\n=A\n?B", 1, 1);
+    testScenarios("A=>B\nB=>C\n=A\n?B\n=B # comment\n?C\n\n=\n?BC", 2, 3);
+    // a query line on its own has no facts
+    testScenarios("A=>B\n?B\n?A", 1, 2);
+    testScenariosThrow("A=>B\n=A\n=B\n?B");
+    testScenariosThrow("A=>B\n=A\n?B\nC=>D\n=C\n?D");
+    testScenariosThrow("A=>B\n=A");
+    testScenariosThrow("A=>B");
+
     std::cout << "\nOK's : " << test_count - ko_count << " / " << test_count << "\n";
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "result_cache.hpp"
+#include "check.hpp"
+
+std::string key(const std::string &rules, const std::string &options = "") {
+    return ResultCache::keyOf(tokenizer(rules), options);
+}
+
+std::shared_ptr<const Evaluation> result(const std::string &conclusion) {
+    auto res = std::make_shared<Evaluation>();
+    res->conclusion = conclusion;
+    return res;
+}
+
+std::string cached(ResultCache &cache, const std::string &key) {
+    auto res = cache.get(key);
+    return res ? res->conclusion : "miss";
+}
+
+int main() {
+    std::cout << "Testing the result cache\n";
+
+    check("SHA-256 of nothing", ResultCache::hex(ResultCache::sha256("")),
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    check("SHA-256 of abc", ResultCache::hex(ResultCache::sha256("abc")),
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    check("SHA-256 over two blocks",
+        ResultCache::hex(ResultCache::sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")),
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    check("SHA-256 of a million a", ResultCache::hex(ResultCache::sha256(std::string(1000000, 'a'))),
+        "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    check("Spacing is not in the key", std::to_string(key("A + B => C\n?C\n") == key("A+B  =>C\n?C\n")), "1");
+    check("Rules are", std::to_string(key("A + B => C\n?C\n") == key("A | B => C\n?C\n")), "0");
+    check("Comments are", std::to_string(key("A => C # one\n?C\n") == key("A => C # two\n?C\n")), "0");
+    check("Lines are", std::to_string(key("A => C\n?C\n") == key("\nA => C\n?C\n")), "0");
+    check("Options are", std::to_string(key("A => C\n?C\n", "lazy=0") == key("A => C\n?C\n", "lazy=1")), "0");
+
+    const size_t cost = 32 + 100;
+    ResultCache cache(2 * cost);
+    const std::string a = key("A => B\n?B\n"), b = key("A => C\n?C\n"), c = key("A => D\n?D\n");
+    check("Miss", cached(cache, a), "miss");
+    cache.put(a, result(std::string(100, 'a')));
+    cache.put(b, result(std::string(100, 'b')));
+    check("Hit", cached(cache, a), std::string(100, 'a'));
+    cache.put(c, result(std::string(100, 'c')));
+    check("Least recently used is evicted", cached(cache, b), "miss");
+    check("Used one is kept", cached(cache, a), std::string(100, 'a'));
+    check("New one is kept", cached(cache, c), std::string(100, 'c'));
+    check("Memory", std::to_string(cache.memory()), std::to_string(2 * cost));
+    check("Hits and misses", std::to_string(cache.hits()) + " " + std::to_string(cache.misses()), "3 2");
+
+    auto evicted = cache.get(c);
+    cache.put(key("A => E\n?E\n"), result(std::string(100, 'e')));
+    cache.put(key("A => F\n?F\n"), result(std::string(100, 'f')));
+    check("Result kept after eviction", evicted->conclusion, std::string(100, 'c'));
+    cache.put(key("A => G\n?G\n"), result(std::string(2 * cost, 'g')));
+    check("Too large is not kept", std::to_string(cache.size()), "2");
+
+    // the first request computes until the others are all waiting for it
+    ResultCache shared(0); // nothing kept, coalescing still happens
+    std::atomic<int> computed = 0;
+    auto slow = [&] {
+        computed++;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (shared.coalesced() < 7 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return result("shared");
+    };
+    std::vector<std::shared_ptr<const Evaluation>> got(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < got.size(); i++)
+        threads.emplace_back([&, i] { got[i] = shared.getOrCompute(a, slow); });
+    for (auto &t : threads)
+        t.join();
+    bool isSame = true;
+    for (auto &res : got)
+        isSame = isSame && res == got[0];
+    check("Concurrent requests computed once", std::to_string(computed) + " " + std::to_string(shared.coalesced()), "1 7");
+    check("And all given its result", std::to_string(isSame) + " " + got[0]->conclusion, "1 shared");
+
+    std::string error;
+    try {
+        shared.getOrCompute(b, []() -> std::shared_ptr<const Evaluation> { throw std::runtime_error("failed"); });
+    } catch (std::exception &e) {
+        error = e.what();
+    }
+    check("Error thrown", error, "failed");
+    check("Computed again after an error", shared.getOrCompute(b, [] { return result("retried"); })->conclusion, "retried");
+
+    checkSummary();
+}
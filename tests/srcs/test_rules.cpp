@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "expert-system.hpp"
 #include "parser.hpp"
 
@@ -9,6 +11,14 @@ struct Test {
 
 bool runTest (const Test& test);
 
+struct ConeTest {
+    string inputFile;
+    DotOptions options;
+    vector<string> expectedLines; // in any order, the maps are unordered
+};
+
+bool runConeTest (const ConeTest& test);
+
 int main()
 {
     std::vector<Rule> rules;
@@ -86,6 +96,49 @@ L + U + E => M  # if X explains Life, the universe and everthing, then X is mean
             std::cout << "OK" << std::endl;
         }
     }
+
+    const string fritz = fileParsingValidation[0].inputFile;
+    vector<ConeTest> coneValidation = {
+        {fritz, {{'G'}, 0, 0}, {
+            "strict digraph {", "  G -> \"(F=>G)\"", "  F -> \"((C+E)=>F)\"", "  C", "  E", "", "",
+            "  \"(F=>G)\" -> F", "  \"((C+E)=>F)\" -> C", "  \"((C+E)=>F)\" -> E", "}"}},
+        {fritz, {{'G'}, 1, 0}, {
+            "strict digraph {", "  G -> \"(F=>G)\"", "  F [style=dashed]", "", "",
+            "  \"(F=>G)\" -> F", "}"}},
+        {"A => Z\nB => Z\nC => Z\nZ => Y\n=A\n?Y\n", {{'Y'}, 0, 2}, {
+            "strict digraph {", "  Y -> \"(Z=>Y)\"", "  \"Z: 3 rules\" [shape=box style=dashed]",
+            "  Z -> \"Z: 3 rules\"", "", "", "  \"(Z=>Y)\" -> Z", "}"}},
+    };
+
+    for (const auto& test : coneValidation) {
+        if (!runConeTest(test)) {
+            std::cerr << "KO" << std::endl;
+        } else {
+            std::cout << "OK" << std::endl;
+        }
+    }
+}
+
+
+bool runConeTest (const ConeTest& test) {
+    auto [rules, facts, queries] = parseTokens(tokenizer(test.inputFile));
+    Digraph digraph = makeDigraph(facts, rules, queries);
+
+    std::ostringstream dot;
+    digraph.writeDot(dot, test.options);
+    vector<string> lines;
+    std::istringstream in(dot.str());
+    for (string line; std::getline(in, line); )
+        lines.push_back(line);
+
+    vector<string> expected = test.expectedLines;
+    std::sort(lines.begin(), lines.end());
+    std::sort(expected.begin(), expected.end());
+    if (lines != expected) {
+        std::cerr << "Expected a cone of " << test.expectedLines.size() << " lines\nGot:\n" << dot.str() << std::endl;
+        return false;
+    }
+    return true;
 }
 
 
@@ -0,0 +1,181 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+#include <thread>
+
+#include "server.hpp"
+#include "check.hpp"
+
+int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        perror("connect");
+    return fd;
+}
+
+// data written step bytes at a time, pause between the writes
+void sendAll(int fd, const std::string &data, size_t step = SIZE_MAX, int pauseMs = 0) {
+    for (size_t i = 0; i < data.size(); i += step) {
+        const size_t size = std::min(step, data.size() - i);
+        if (send(fd, data.data() + i, size, MSG_NOSIGNAL) != ssize_t(size))
+            perror("send");
+        if (pauseMs)
+            std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+    }
+}
+
+// The first n responses read on fd, as "status body|" for the plain text
+// ones and "status|" for the others, "closed" once the server closed it
+// and "timeout" when nothing comes
+std::string readResponses(int fd, size_t n) {
+    std::string buffer, res;
+    char chunk[4096];
+    while (n > 0) {
+        const size_t end = buffer.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            const std::string head = buffer.substr(0, end);
+            const size_t length = std::stoul(head.substr(head.find("Content-Length: ") + 16));
+            if (buffer.size() >= end + 4 + length) {
+                std::string body = buffer.substr(end + 4, length);
+                res += head.substr(9, 3);
+                if (head.find("text/plain") != std::string::npos)
+                    res += " " + body.substr(0, body.find('\n'));
+                res += "|";
+                buffer.erase(0, end + 4 + length);
+                n--;
+                continue;
+            }
+        }
+        ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+        if (bytes == 0)
+            return res + "closed";
+        if (bytes < 0)
+            return res + "timeout";
+        buffer.append(chunk, bytes);
+    }
+    return res;
+}
+
+// First line of the response to request, on a connection of its own
+std::string statusLineOf(int port, const std::string &request) {
+    int fd = connectTo(port);
+    sendAll(fd, request);
+    std::string res;
+    char c;
+    while (recv(fd, &c, 1, 0) == 1 && c != '\r')
+        res += c;
+    close(fd);
+    return res;
+}
+
+std::string get(const std::string &target, const std::string &extra = "") {
+    return "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n" + extra + "\r\n";
+}
+
+int main() {
+    std::cout << "Testing the server over its socket\n";
+
+    InputOptions opts;
+    opts.port = 0;  // any free one
+    opts.keepAlive = 1;
+    opts.threads = 2;
+    WebServer server(opts);
+    std::thread loop([&server] { server.start(); });
+    InputOptions workerOpts = opts;
+    workerOpts.workers = 2;  // as one of them, without forking
+    WebServer worker(workerOpts);
+    std::thread workerLoop([&worker] { worker.start(); });
+
+    const std::string hA = SessionStore::handleOf("A=>B");
+    const std::string hC = SessionStore::handleOf("C=>D");
+    const std::string pipelined = get("/session?rules=A%3D%3EB") + get("/nowhere")
+        + get("/session?rules=C%3D%3ED");
+
+    const int port = server.port();
+    int fd = connectTo(port);
+    sendAll(fd, pipelined);
+    check("Pipelined, answered in order", readResponses(fd, 3), "200 " + hA + "|404|200 " + hC + "|");
+
+    sendAll(fd, pipelined, 7);
+    check("Pipelined in pieces", readResponses(fd, 3), "200 " + hA + "|404|200 " + hC + "|");
+
+    check("Status line", statusLineOf(port, get("/favicon.ico")), "HTTP/1.1 200 OK");
+    check("Status line of an error", statusLineOf(port, get("/nowhere")), "HTTP/1.1 404 Not Found");
+
+    sendAll(fd, get("/graph/" + GraphRenderer::keyOf("digraph {}", opts.graphFormat)));
+    check("Unknown graph", readResponses(fd, 1), "404 Error: Unknown graph, submit the rules again|");
+
+    const std::string chunked = "POST /session HTTP/1.1\r\nHost: localhost\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n"
+        "3\r\nA =\r\n4\r\n> B\n\r\n0\r\n\r\n";
+    sendAll(fd, chunked, 5, 20);
+    check("Chunked body", readResponses(fd, 1), "200 " + SessionStore::handleOf("A => B\n") + "|");
+
+    sendAll(fd, chunked + get("/session?rules=A%3D%3EB"));
+    check("Chunked then pipelined", readResponses(fd, 2),
+        "200 " + SessionStore::handleOf("A => B\n") + "|200 " + hA + "|");
+
+    sendAll(fd, get("/session?rules=C%3D%3ED", "Connection: close\r\n"));
+    check("Connection: close", readResponses(fd, 2), "200 " + hC + "|closed");
+    close(fd);
+
+    fd = connectTo(port);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    check("Idle connection closed", readResponses(fd, 1), "closed");
+    close(fd);
+
+    // hung up with a reset while their request is answered, the loop must
+    // not be woken up again and again meanwhile
+    std::string rules;
+    for (int i = 0; i < 5000; i++)
+        rules += "A + B => C\n";
+    const std::string slow = "POST /session HTTP/1.1\r\nHost: localhost\r\nContent-Length: "
+        + std::to_string(rules.size()) + "\r\n\r\n" + rules;
+    const size_t before = server.wakeups();
+    for (int i = 0; i < 4; i++) {
+        fd = connectTo(port);
+        sendAll(fd, slow);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        linger reset{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(fd);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    // a few per connection and one a second, a loop woken up by the hang
+    // ups over and over comes back thousands of times
+    const size_t wakeups = server.wakeups() - before;
+    check("No spinning on hung up connections", wakeups < 200,
+        "  " + std::to_string(wakeups) + " wake ups\n");
+
+    fd = connectTo(port);
+    sendAll(fd, get("/session?rules=A%3D%3EB"));
+    check("Still serving", readResponses(fd, 1), "200 " + hA + "|");
+    close(fd);
+
+    fd = connectTo(worker.port());
+    sendAll(fd, get("/session?rules=A%3D%3EB") + "POST /session HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n\r\nA=>B");
+    check("No sessions in a worker", readResponses(fd, 2),
+        "501 Error: sessions are kept by a single server process, run it without --workers|"
+        "501 Error: sessions are kept by a single server process, run it without --workers|");
+
+    // the links of a worker's pages carry their DOT, any worker renders it
+    const std::string dotKey = GraphRenderer::keyOf("digraph {}", opts.graphFormat);
+    sendAll(fd, get("/graph/" + dotKey + "?dot=digraph%7B%7D") + get("/graph/" + dotKey + "?dot=digraph%20%7B%7D"));
+    check("Graph from the DOT of its link", readResponses(fd, 2),
+        "404 Error: Unknown graph, submit the rules again|200|");
+    close(fd);
+
+    server.stop();
+    worker.stop();
+    loop.join();
+    workerLoop.join();
+
+    checkSummary();
+}
@@ -0,0 +1,67 @@
+#include <sstream>
+
+#include "session.hpp"
+#include "check.hpp"
+
+std::string answer(SessionStore &store, const std::string &handle, const std::string &facts) {
+    auto file = store.get(handle);
+    if (!file)
+        return "evicted";
+    auto res = file->kb.evaluate(KnowledgeBase::factMask(facts), file->queries);
+    std::string out;
+    for (auto state : res.states)
+        out += state == Fact::State::True ? "T" : state == Fact::State::False ? "F" : "U";
+    return out;
+}
+
+std::string thrown(SessionStore &store, const std::string &rules) {
+    try {
+        store.add(rules);
+        return "no error";
+    } catch (std::exception &e) {
+        return e.what();
+    }
+}
+
+int main() {
+    std::cout << "Testing sessions\n";
+
+    const std::string a = "A + B => C\n=A\n?C\n";
+    const std::string b = "A | B => D\n?D\n";
+    const std::string c = "A => E\nE => F\n?F\n";
+    const RuleFile fileC = parseRuleFile("", c);
+    const size_t cost = fileC.kb.memoryEstimate();
+
+    check("Estimate counts the graph and its compiled expressions",
+        std::to_string(cost > fileC.kb.serialize().size() + 26 * sizeof(Fact)), "1");
+    check("Estimate grows with the rules", std::to_string(
+        parseRuleFile("", "A => E\nE => F\nF => G\nG => H\n").kb.memoryEstimate() > cost), "1");
+
+    // room for two sessions the size of c, a and b are smaller
+    SessionStore store(2 * cost);
+    std::string ha = store.add(a);
+    check("Handle is the rules hash", ha, SessionStore::handleOf(a));
+    check("Same rules, same handle", store.add(a), ha);
+    check("Handle is SHA-256", SessionStore::handleOf("abc"),
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    check("One session", std::to_string(store.size()), "1");
+    check("Default facts", answer(store, ha, "A"), "F");
+    check("Given facts", answer(store, ha, "AB"), "T");
+    check("Unknown handle", answer(store, "0123", "A"), "evicted");
+
+    std::string hb = store.add(b);
+    check("Second session", answer(store, hb, "B"), "T");
+    answer(store, ha, "A"); // a is now the most recently used
+    std::string hc = store.add(c);
+    check("Least recently used is evicted", answer(store, hb, "B"), "evicted");
+    check("Used one is kept", answer(store, ha, "AB"), "T");
+    check("New one is kept", answer(store, hc, "A"), "T");
+    check("Memory stays under the cap", std::to_string(store.memory() <= 2 * cost), "1");
+
+    SessionStore small(cost - 1);
+    check("Too large", thrown(small, c), "Rule set too large for the session store");
+    check("Parse error", thrown(store, "A => \n?A\n") == "no error" ? "no error" : "error", "error");
+    check("Nothing added on error", std::to_string(small.size()), "0");
+
+    checkSummary();
+}
@@ -1,5 +1,6 @@
 #include "expert-system.hpp"
 #include "parser.hpp"
+#include "thread_pool.hpp"
 
 #define GREEN   "\033[32m"
 #define RED     "\033[31m"
@@ -48,6 +49,168 @@ void runTest(const Test &t) {
     cout << "--------------------------------------\n";
 }
 
+// What a graph built for text, rules, facts and queries, concludes
+Digraph::SolveRes solveAlone(const std::string &text) {
+    auto [rules, facts, queries] = parseTokens(tokenizer(text));
+    Digraph single = makeDigraph(facts, rules, queries);
+    single.applyWorldAssumption(false);
+    return single.solveEverythingNoThrow(queries);
+}
+
+// The cases of one test: each one that differs is printed as it comes, OK
+// once at the end if none did
+struct Report {
+    bool failed = false;
+
+    void compare(const std::string &description, const std::string &got, const std::string &expected) {
+        if (got == expected)
+            return;
+        cout << RED << "Test failed: " << RESET << description << endl;
+        cout << "got\n" << got << "expected\n" << expected << RED << "KO" << RESET << endl;
+        failed = true;
+    }
+
+    void end() const {
+        if (!failed)
+            cout << GREEN << "OK" << RESET << endl;
+    }
+};
+
+// Parallel query solving must conclude exactly what the sequential solve does
+void runParallelTest(const Test &t) {
+    auto [rules, facts, queries] = parseTokens(tokenizer(t.ruleSet));
+    Digraph parallel = makeDigraph(facts, rules, queries);
+    parallel.applyWorldAssumption(false);
+
+    auto expected = solveAlone(t.ruleSet);
+    auto res = parallel.solveQueriesParallel(queries, 4);
+
+    Report report;
+    report.compare(t.description + " (parallel)",
+        res.conlusion + (res.isError ? "error\n" : ""),
+        expected.conlusion + (expected.isError ? "error\n" : ""));
+    report.end();
+}
+
+// Every task runs once, after the ones it waits on, even with every worker
+// of the pool busy elsewhere
+void runTaskGraphTest(const std::string &description, size_t busy) {
+    const size_t n = 64;
+    std::vector<std::vector<size_t>> dependents(n);
+    std::vector<size_t> pending(n, 0);
+    for (size_t t = 1; t < n; t++) {
+        for (size_t d : {(t - 1) / 2, t / 3}) {
+            if (d != t) {
+                dependents[d].push_back(t);
+                pending[t]++;
+            }
+        }
+    }
+
+    ThreadPool pool(4);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    for (size_t i = 0; i < busy; i++)
+        pool.submit([released] { released.wait(); });
+
+    std::vector<std::atomic<int>> runs(n);
+    std::atomic<bool> early{false};
+    runTaskGraph(pool, 4, dependents, pending, [&](size_t t) {
+        for (size_t d : {(t - 1) / 2, t / 3})
+            if (t > 0 && d != t && runs[d] != 1)
+                early = true;
+        runs[t]++;
+    });
+    release.set_value();
+    std::string counts;
+    for (size_t t = 0; t < n; t++)
+        if (runs[t] != 1)
+            counts += std::to_string(t) + " ran " + std::to_string(runs[t]) + " times\n";
+
+    Report report;
+    report.compare(description, counts + (early ? "started early\n" : ""), "");
+    report.end();
+}
+
+// Batch evaluation must conclude what solving each scenario on its own does
+void runScenarioTest(const std::string &description, const std::string &ruleSet,
+        const std::vector<std::string> &factLines, const std::string &queryLine) {
+    auto [rules, _, queries] = parseTokens(tokenizer(ruleSet + "\n=\n" + queryLine));
+    Digraph batch = makeDigraph({}, rules, queries);
+
+    std::vector<std::vector<Fact>> scenarios;
+    for (const auto &line : factLines) {
+        auto [r, facts, q] = parseTokens(tokenizer(ruleSet + "\n" + line + "\n" + queryLine));
+        scenarios.push_back(facts);
+    }
+    auto res = batch.solveScenarios(scenarios, queries);
+
+    Report report;
+    for (size_t i = 0; i < factLines.size(); i++) {
+        auto expected = solveAlone(ruleSet + "\n" + factLines[i] + "\n" + queryLine);
+        report.compare(description + " " + factLines[i], res[i].conclusion, expected.conlusion);
+    }
+    report.end();
+}
+
+// Facts updated in place must conclude what a graph built for them does
+void runUpdateTest(const std::string &description, const std::string &ruleSet,
+        const std::vector<std::string> &factLines, const std::string &queryLine) {
+    auto [rules, facts, queries] = parseTokens(tokenizer(ruleSet + "\n" + factLines[0] + "\n" + queryLine));
+    Digraph updated = makeDigraph(facts, rules, queries);
+    updated.applyWorldAssumption(false);
+    updated.solveEverythingNoThrow(queries);
+
+    Report report;
+    for (size_t i = 1; i < factLines.size(); i++) {
+        const std::string text = ruleSet + "\n" + factLines[i] + "\n" + queryLine;
+        auto [r, f, q] = parseTokens(tokenizer(text));
+        updated.updateFacts(f, queries, false);
+        report.compare(description + " " + factLines[i],
+            updated.solveEverythingNoThrow(queries).conlusion, solveAlone(text).conlusion);
+    }
+    report.end();
+}
+
+// A what-if on a snapshot must conclude what a graph built with those facts
+// does, and leave the snapshot it forked from as it was. In a what-if "B!A",
+// B is set True and A False, only facts no rule concludes are set False, the
+// graph they are compared to is given the fact line without them.
+void runWhatIfTest(const std::string &description, const std::string &ruleSet,
+        const std::string &factLine, const std::vector<std::string> &whatIfs, const std::string &queryLine) {
+    auto [rules, facts, queries] = parseTokens(tokenizer(ruleSet + "\n" + factLine + "\n" + queryLine));
+    Digraph digraph = makeDigraph(facts, rules, queries);
+    digraph.applyWorldAssumption(false);
+    auto before = digraph.solveEverythingNoThrow(queries);
+    auto snap = digraph.snapshot();
+
+    Report report;
+    for (const auto &extra : whatIfs) {
+        uint32_t set_true = 0, set_false = 0;
+        std::string given;
+        for (size_t i = 0; i < extra.size(); i++) {
+            if (extra[i] == '!')
+                set_false |= 1u << (extra[++i] - 'A');
+            else
+                set_true |= 1u << (extra[i] - 'A');
+        }
+        for (char c : factLine + extra) {
+            if (c == '=' || (c >= 'A' && c <= 'Z' && !(set_false & (1u << (c - 'A')))))
+                given += c;
+        }
+        auto fork = digraph.whatIf(snap, set_true, set_false, queries);
+        report.compare(description + " " + extra, fork.result().conlusion,
+            solveAlone(ruleSet + "\n" + given + "\n" + queryLine).conlusion);
+        // layered over the snapshot's rules, not a copy of them
+        if (fork.solved != snap.solved)
+            report.compare(description + " " + extra + " layered",
+                std::to_string(fork.solved->useless_rules.base.get() == &snap.solved->useless_rules), "1");
+        // rolling back is dropping the fork
+        report.compare(description + " " + extra + " snapshot", snap.result().conlusion, before.conlusion);
+    }
+    report.end();
+}
+
 int main() {
     cout << "Testing solver" << endl;
 
@@ -168,4 +331,76 @@ int main() {
     for (const auto &t : tests) {
         runTest(t);
     }
+
+    cout << "Testing parallel query solving" << endl;
+    for (const auto &t : tests) {
+        runParallelTest(t);
+    }
+    runParallelTest({
+        "Independent and overlapping cones",
+        "A=>B\nC=>D\nB+D=>E\nF|G=>H\nI=>!J\n=ACF\n?BDEHJ",
+        {}
+    });
+    runParallelTest({
+        "Single deep query over a wide acyclic graph",
+        "A+B=>C\nA|B=>D\nC^D=>E\nB+!A=>F\nE|F=>G\nC+F=>H\nG+H=>I\nD|I=>J\n"
+        "J+C=>K\nK|F=>L\nL+E=>M\nM^H=>N\nA=>O\nO+N=>P\nP|D=>Q\nQ+G=>R\n"
+        "R|K=>S\nS+M=>T\nX=>Y\nY<=>Z\nZ+Q=>U\n=AB\n?TU",
+        {}
+    });
+
+    cout << "Testing the task graph" << endl;
+    runTaskGraphTest("Task graph on an idle pool", 0);
+    runTaskGraphTest("Task graph on a busy pool", 4);
+
+    cout << "Testing scenarios" << endl;
+    std::vector<std::string> factLines;
+    for (int m = 0; m < 64 * 3; m++) {
+        std::string line = "=";
+        for (int b = 0; b < 6; b++) {
+            if ((m * 37 >> b) & 1)
+                line += char('A' + b);
+        }
+        factLines.push_back(line);
+    }
+    runScenarioTest("Bit sliced rules",
+        "A+B=>G\n!C|D=>H\nG^H=>I\nE+!F=>J\nI|J=>K\n!K=>L\nA=>L",
+        factLines, "?GHIJKL");
+    runScenarioTest("Rules that fall back to solving each scenario",
+        "A+B=>G\nG=>H|I\nC<=>J\nJ+D=>!K\nE|F=>K",
+        factLines, "?GHIJK");
+
+    cout << "Testing fact updates" << endl;
+    runUpdateTest("Independent queries",
+        "A+B=>G\n!C|D=>H\nG^H=>I\nE+!F=>J\nI|J=>K\n!K=>L\nA=>L",
+        std::vector<std::string>(factLines.begin(), factLines.begin() + 64), "?GJHL");
+    // J decides whether B's search goes through E, which is where C's search
+    // would start otherwise
+    runUpdateTest("Changed search order",
+        "!H+F=>D\n!A^A=>C|E\nF=>D\n!((!((A+G))+B+!C))=>D\n!((J|!E)|(G+B))=>B\nI=>E^C\n(F+C)=>J",
+        {"=", "=JGH", "=", "=C", "=JGH", "=JGH"}, "?BCH");
+
+    cout << "Testing what-if" << endl;
+    runWhatIfTest("Independent queries",
+        "A+B=>G\n!C|D=>H\nG^H=>I\nE+!F=>J\nI|J=>K\n!K=>L\nA=>L",
+        "=A", {"", "B", "C", "BD", "EF", "E", "BCDEF"}, "?GJHL");
+    runWhatIfTest("Changed search order",
+        "!H+F=>D\n!A^A=>C|E\nF=>D\n!((!((A+G))+B+!C))=>D\n!((J|!E)|(G+B))=>B\nI=>E^C\n(F+C)=>J",
+        "=", {"JGH", "C", "", "I"}, "?BCH");
+    runWhatIfTest("Given facts set False",
+        "A+B=>G\n!C|D=>H\nG^H=>I\nE+!F=>J\nI|J=>K\n!K=>L\nA=>L",
+        "=ABCE", {"!A", "!C", "D!B", "!A!B!C!E", "F!E"}, "?GJHL");
+
+    auto [rules, facts, queries] = parseTokens(tokenizer("A+B=>C\n=A\n?C"));
+    Digraph digraph = makeDigraph(facts, rules, queries);
+    digraph.applyWorldAssumption(false);
+    digraph.solveEverythingNoThrow(queries);
+    Report report;
+    try {
+        digraph.whatIf(digraph.snapshot(), 0b10, 0b11, queries);
+        report.compare("Fact both True and False", "accepted", "rejected");
+    } catch (const std::invalid_argument &e) {
+        report.compare("Fact both True and False", e.what(), "A fact can't be both True and False");
+    }
+    report.end();
 }
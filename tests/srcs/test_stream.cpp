@@ -0,0 +1,57 @@
+#include <fstream>
+#include <sstream>
+
+#include "stream.hpp"
+#include "check.hpp"
+
+int main() {
+    std::cout << "Testing stream records\n";
+
+    const std::string path = "/tmp/test_stream_rules.txt";
+    std::ofstream(path) << "A + B => C\nC => D\nH => I\nH => !I\n=A\n?CD\n";
+    RuleFile file = loadRuleFile(path);
+
+    check("File queries and facts", handleStreamRecord(file, "{}"),
+        R"({"id":null,"results":{"C":"False","D":"False"}})");
+    check("Facts and queries", handleStreamRecord(file, R"({"id": 7, "facts": "AB", "queries": "DC"})"),
+        R"({"id":7,"results":{"D":"True","C":"True"}})");
+    check("String id and unknown field", handleStreamRecord(file, R"( {"x": true, "id":"a\"b", "facts":"B"} )"),
+        R"({"id":"a\"b","results":{"C":"False","D":"False"}})");
+    check("Empty facts", handleStreamRecord(file, R"({"facts":"","queries":"C"})"),
+        R"({"id":null,"results":{"C":"False"}})");
+    check("Query in error", handleStreamRecord(file, R"({"id":1,"facts":"H","queries":"I"})"),
+        R"({"id":1,"results":{"I":"Error"}})");
+    check("Invalid fact", handleStreamRecord(file, R"({"id":2,"facts":"a"})"),
+        R"({"id":2,"error":"Invalid fact: a"})");
+    check("Not an object", handleStreamRecord(file, R"([1])"),
+        R"({"id":null,"error":"Expected '{' at column 1"})");
+    check("Nested value", handleStreamRecord(file, R"({"id":3,"facts":["A"]})"),
+        R"({"id":3,"error":"Unsupported value at column 17"})");
+    check("Trailing characters", handleStreamRecord(file, R"({"id":4} x)"),
+        R"({"id":4,"error":"Trailing characters at column 10"})");
+    check("No queries", handleStreamRecord(file, R"({"queries":""})"),
+        R"({"id":null,"error":"No queries"})");
+
+    // the whole pipeline keeps input order whatever the number of threads
+    std::string input, expected;
+    for (int i = 0; i < 2000; i++) {
+        std::string facts = i % 3 == 0 ? "AB" : i % 3 == 1 ? "A" : "H";
+        input += R"({"id":)" + std::to_string(i) + R"(,"facts":")" + facts + "\"}\n";
+        if (i % 100 == 0)
+            input += "\n";
+        expected += handleStreamRecord(file, R"({"id":)" + std::to_string(i)
+            + R"(,"facts":")" + facts + "\"}") + "\n";
+    }
+    for (size_t jobs : {1, 4}) {
+        InputOptions opts;
+        opts.file = const_cast<char *>(path.c_str());
+        opts.jobs = jobs;
+        std::istringstream in(input);
+        std::ostringstream out;
+        int ret = runStream(opts, in, out);
+        check("Pipeline order, " + std::to_string(jobs) + " jobs", std::to_string(ret) + "\n" + out.str(),
+            "0\n" + expected);
+    }
+
+    checkSummary();
+}